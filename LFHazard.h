@@ -0,0 +1,113 @@
+#ifndef _LFQ_HAZARD_H_
+#define _LFQ_HAZARD_H_
+
+/*
+ * Hazard pointer domains, declared apart from LFQueue.h so that C++ code
+ * (LFQueue.hpp) can include them. Objects the library does not know, such as
+ * the nodes of lfq::queue<T>, start with an lfq_block_t and are retired whole;
+ * Scan() hands them to their reclaim function once no hazard pointer holds them.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define LFQ_HP_SLOTS (2) /*hazard pointers per record*/
+#define LFQ_HP_THREAD_SLOTS (64) /*domains a thread can hold a record in at once, power of two*/
+#define LFQ_HP_THREAD_WAYS (4) /*slots per set of that table; domains hashing to one set only evict beyond this*/
+#define LFQ_POOL_MAX_OBJECT (256) /*largest LFQueue_pool_alloc() size served from the node pool*/
+
+#ifdef __cplusplus
+#define LFQ_THREAD_LOCAL thread_local
+#else
+#define LFQ_THREAD_LOCAL _Thread_local
+#endif
+
+typedef struct hp_domain hp_domain_t; /*record list + retire threshold, private per queue or shared*/
+typedef struct HPRecord hp_record_t; /*per-thread, per-domain*/
+
+typedef struct lfq_block {
+    struct lfq_block* retired_next;
+    void (*reclaim)(struct lfq_block* block); /*NULL: free()*/
+}lfq_block_t;
+
+/*
+ * A shared domain must outlive every queue that uses it. Destroying a domain frees
+ * its records and the nodes still retired in them, and leaves other domains alone.
+ */
+hp_domain_t* hp_domain_create(void);
+int hp_domain_destroy(hp_domain_t* domain);
+
+hp_record_t* hp_domain_thread_record(hp_domain_t* domain); /*the calling thread's record, taken on first use*/
+unsigned long long hp_domain_id(hp_domain_t* domain); /*unique per domain for the life of the process, never 0*/
+void* hp_record_slots(hp_record_t* record); /*its LFQ_HP_SLOTS hazard pointers, lock-free atomic pointers*/
+void hp_retire_block(hp_record_t* record, lfq_block_t* block); /*block must be unreachable for new readers*/
+/*the same for a block of at most LFQ_POOL_MAX_OBJECT bytes: it waits for the node threshold (4H), not H + slack*/
+void hp_retire_small_block(hp_record_t* record, lfq_block_t* block);
+
+/*
+ * The calling thread's records, in sets of LFQ_HP_THREAD_WAYS ways kept in most
+ * recently used order. Only the library writes them; hp_thread_record() reads
+ * the first way of a set so that the common case needs no call.
+ */
+typedef struct {
+    hp_domain_t* domain;
+    unsigned long long id;
+    hp_record_t* record;
+}hp_thread_slot_t;
+
+extern LFQ_THREAD_LOCAL hp_thread_slot_t hp_thread_slots[LFQ_HP_THREAD_SLOTS];
+
+/*hp_domain_thread_record() with the hit inlined; id is hp_domain_id(domain)*/
+static inline hp_record_t* hp_thread_record(hp_domain_t* domain, unsigned long long id)
+{
+    hp_thread_slot_t* slot = &hp_thread_slots[(id & (LFQ_HP_THREAD_SLOTS / LFQ_HP_THREAD_WAYS - 1)) * LFQ_HP_THREAD_WAYS];
+    if (slot->domain == domain && slot->id == id)
+    {
+        return slot->record;
+    }
+    return hp_domain_thread_record(domain);
+}
+
+/*
+ * Fixed-size objects from the node pool's per-thread caches, in power-of-two
+ * classes up to LFQ_POOL_MAX_OBJECT bytes, aligned to at least 16 bytes.
+ * Larger sizes (and builds without LFQ_NODE_POOL) use malloc(). Free with the
+ * size the object was allocated with; any thread may free it.
+ */
+void* LFQueue_pool_alloc(size_t size);
+void LFQueue_pool_free(void* object, size_t size);
+
+typedef struct {
+    size_t handoffs;                 /*retired lists handed to the reclaimer*/
+    size_t items_handed_off;         /*nodes and blocks in them*/
+    size_t rounds;                   /*reclaimer wake-ups that collected something*/
+    size_t backlog;                  /*handed off, or kept as hazardous by the reclaimer, not yet freed*/
+    size_t inline_scans;             /*threshold hits that scanned inline because the backlog was full*/
+    unsigned long long max_lag_ns;   /*longest time from a hand-off to its collection*/
+    unsigned long long total_lag_ns; /*summed per round; total_lag_ns / rounds is the mean*/
+}lfq_reclaimer_stats_t;
+
+/*
+ * Opt-in background reclamation. Once started, a record whose retired list
+ * reaches the threshold hands the whole list to the domain's reclaimer thread
+ * with one CAS instead of running Scan() and HelpScan() itself, so retiring
+ * stays O(1) for the calling thread. The reclaimer runs until the domain is
+ * destroyed; starting it again is a no-op. Epoch-reclaimed queues are not affected.
+ */
+int hp_domain_start_reclaimer(hp_domain_t* domain);
+int hp_domain_get_reclaimer_stats(hp_domain_t* domain, lfq_reclaimer_stats_t* stats); /*all zero if never started*/
+
+/*
+ * Releases the calling thread's records in every domain. It also runs when a
+ * thread that took a record exits, so calling it is only needed to give the
+ * records back earlier.
+ */
+void LFQueue_cleanup_thread(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
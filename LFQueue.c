@@ -1,8 +1,24 @@
+#define _GNU_SOURCE
 #include "LFQueue.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#if LFQ_ASYMMETRIC_FENCE
+#include <linux/membarrier.h>
+#endif
+#endif
 
 static int default_error_callback(const char *format, ...)
 {
@@ -16,6 +32,18 @@ static int default_error_callback(const char *format, ...)
 
 int (*LFQueue_error_callback)(const char *, ...) = default_error_callback;
 
+/*Per-record counters are only written by the record's owner, so a relaxed load/store pair is enough*/
+#if LFQ_STATS
+#define LFQ_STAT_ADD(hprec, field, n) \
+    atomic_store_explicit(&(hprec)->stats.field, \
+                          atomic_load_explicit(&(hprec)->stats.field, memory_order_relaxed) + (n), memory_order_relaxed)
+#define LFQ_STAT_SET(hprec, field, v) atomic_store_explicit(&(hprec)->stats.field, (v), memory_order_relaxed)
+#else
+#define LFQ_STAT_ADD(hprec, field, n) ((void)(hprec))
+#define LFQ_STAT_SET(hprec, field, v) ((void)0)
+#endif
+#define LFQ_STAT_INC(hprec, field) LFQ_STAT_ADD(hprec, field, 1)
+
 void LFQueue_set_error_callback(int (*errback)(const char *, ...))
 {
     if (!errback)
@@ -26,541 +54,4184 @@ void LFQueue_set_error_callback(int (*errback)(const char *, ...))
     LFQueue_error_callback = errback;
 }
 
-static atomic_uint g_numOfHPRecord = ATOMIC_VAR_INIT(0); /*total hazard pointers across all threads*/
-static atomic_uint g_retireThreshold = ATOMIC_VAR_INIT(0);
+/*
+ * Node pool: a per-thread cache of free nodes backed by a lock-free global
+ * overflow list and cache-line-aligned slabs. Scan() hands reclaimed nodes back
+ * here (PrepareForReuse) instead of free(), and enqueueLF() takes them from here
+ * instead of malloc(), so the allocator stays off the hot path. Class 0 holds
+ * node_t; the others serve LFQueue_pool_alloc() (the nodes of lfq::queue<T>)
+ * by power-of-two size and link free objects through their first word.
+ */
+#define LFQ_POOL_CLASSES (5) /*node_t, then 32, 64, 128 and LFQ_POOL_MAX_OBJECT bytes*/
 
-static void update_retireThreshold(void)
+#if LFQ_NODE_POOL
+typedef struct pool_slab
 {
-    unsigned current_H = atomic_load_explicit(&g_numOfHPRecord, memory_order_relaxed);
-    unsigned expected_R = atomic_load_explicit(&g_retireThreshold, memory_order_relaxed);
-    unsigned desired_R = current_H << 2; /*H * (1+c), where c = 3*/
+    struct pool_slab *next;
+    alignas(CACHE_LINE_SIZE) unsigned char objects[];
+} pool_slab_t;
 
-    int retry_count = 0;
-    const int max_retires = 10;
-    while (!atomic_compare_exchange_weak_explicit(&g_retireThreshold, &expected_R, desired_R,
-                                                  memory_order_acq_rel, memory_order_acquire))
-    {
-        if (++retry_count >= max_retires)
-        {
-            break;
-        }
+typedef struct
+{
+    _Atomic(void *) overflow;
+    _Atomic(pool_slab_t *) slabs;
+    size_t size;
+    size_t link; /*offset of the atomic pointer that links free objects*/
+} pool_class_t;
 
-        current_H = atomic_load_explicit(&g_numOfHPRecord, memory_order_relaxed);
-        desired_R = current_H << 2;
-    }
+typedef struct
+{
+    void *head; /*free objects, linked through the class's link*/
+    size_t count;
+    size_t hits;   /*not yet flushed to the global counters*/
+    unsigned generation; /*of the pool the objects come from, see pool_thread_cache()*/
+} pool_cache_t;
+
+#define LFQ_POOL_STATS_FLUSH (1024)
+
+static pool_class_t g_poolClasses[LFQ_POOL_CLASSES] = {
+    {NULL, NULL, sizeof(node_t), offsetof(node_t, next)},
+    {NULL, NULL, 32, 0},
+    {NULL, NULL, 64, 0},
+    {NULL, NULL, 128, 0},
+    {NULL, NULL, LFQ_POOL_MAX_OBJECT, 0},
+};
+
+static _Thread_local pool_cache_t g_threadPoolCaches[LFQ_POOL_CLASSES];
+
+static atomic_size_t g_nodeCacheSize = ATOMIC_VAR_INIT(LFQ_POOL_DEFAULT_CACHE_SIZE);
+
+static atomic_size_t g_poolHits = ATOMIC_VAR_INIT(0);
+static atomic_size_t g_poolMisses = ATOMIC_VAR_INIT(0);
+static atomic_size_t g_poolSlabs = ATOMIC_VAR_INIT(0);
+static atomic_uint g_poolGeneration = ATOMIC_VAR_INIT(0); /*bumped by LFQueue_pool_release()*/
+
+static inline _Atomic(void *) *pool_link(const pool_class_t *cls, void *object)
+{
+    return (_Atomic(void *) *)(void *)((unsigned char *)object + cls->link);
 }
 
-static inline void rlist_push(node_t **head, node_t *node)
+static inline void pool_chain_link(const pool_class_t *cls, void *object, void *next)
 {
-    // node->next = *head;
-    // atomic_store_explicit(&node->next, *head, memory_order_seq_cst);
+    atomic_store_explicit(pool_link(cls, object), next, memory_order_relaxed);
+}
 
-    node->retired_next = *head;
-    *head = node;
+static inline void *pool_chain_next(const pool_class_t *cls, void *object)
+{
+    return atomic_load_explicit(pool_link(cls, object), memory_order_relaxed);
 }
-static inline node_t *rlist_pop(node_t **head)
+
+/*Pushing a whole chain is ABA-safe; only pop needs care, see overflow_take()*/
+static void overflow_push(pool_class_t *cls, void *first, void *last)
 {
-    if (!head || !(*head))
+    void *oldhead = atomic_load_explicit(&cls->overflow, memory_order_relaxed);
+    do
     {
-
-        return NULL;
-    }
-
-    node_t *node_to_return = *head;
-    // *head = (*head)->next;
-    // node_t* next_node = atomic_load_explicit(&node_to_return->next, memory_order_seq_cst); *head = next_node;
-    *head = (*head)->retired_next;
-
-    return node_to_return;
+        pool_chain_link(cls, last, oldhead);
+    } while (!atomic_compare_exchange_weak_explicit(&cls->overflow, &oldhead, first,
+                                                    memory_order_release, memory_order_relaxed));
 }
 
-unsigned rlist_delete(node_t *head)
+/*Detach the whole list with one exchange, keep up to max objects and give the rest back*/
+static void *overflow_take(pool_class_t *cls, size_t max, size_t *taken)
 {
-    if (!head)
+    *taken = 0;
+    void *list = atomic_exchange_explicit(&cls->overflow, NULL, memory_order_acquire);
+    if (!list)
     {
-        return 0;
+        return NULL;
     }
 
-    unsigned node_count = 0;
+    void *last = list;
+    size_t count = 1;
+    while (count < max && pool_chain_next(cls, last))
+    {
+        last = pool_chain_next(cls, last);
+        count++;
+    }
 
-    node_t *curr_node = head;
-    node_t *next_node = NULL;
-    while (curr_node)
+    void *rest = pool_chain_next(cls, last);
+    pool_chain_link(cls, last, NULL);
+    while (rest)
     {
-        node_count++;
-        // next_node = curr_node->next;
-        // next_node = atomic_load_explicit(&curr_node->next, memory_order_seq_cst);
-        next_node = curr_node->retired_next;
-        free(curr_node);
-        curr_node = next_node;
+        /*usually nobody pushed meanwhile and the remainder goes back in O(1)*/
+        void *expected = NULL;
+        if (atomic_compare_exchange_strong_explicit(&cls->overflow, &expected, rest,
+                                                    memory_order_release, memory_order_relaxed))
+        {
+            break;
+        }
+
+        /*otherwise detach the few objects pushed since and chain the remainder behind them*/
+        void *pushed = atomic_exchange_explicit(&cls->overflow, NULL, memory_order_acquire);
+        if (!pushed)
+        {
+            continue;
+        }
+        void *pushed_last = pushed;
+        while (pool_chain_next(cls, pushed_last))
+        {
+            pushed_last = pool_chain_next(cls, pushed_last);
+        }
+        pool_chain_link(cls, pushed_last, rest);
+        rest = pushed;
     }
 
-    return node_count;
+    *taken = count;
+    return list;
 }
 
-static _Atomic(hp_record_t*) g_HPRecordHead = NULL;
-static _Thread_local hp_record_t *g_threadHPRecord = NULL;
-
-static hp_record_t *HPRecord_allocate(void)
+static pool_slab_t *pool_slab_allocate(pool_class_t *cls)
 {
-    hp_record_t *me = malloc(sizeof(hp_record_t));
-    if (!me)
+    size_t bytes = offsetof(pool_slab_t, objects) + cls->size * LFQ_POOL_SLAB_NODES;
+    bytes = (bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    pool_slab_t *slab = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    if (!slab)
     {
         return NULL;
     }
 
-    atomic_init(&me->active, true);
-    me->rlist = NULL;
-    me->rcount = 0;
-    atomic_store_explicit(&me->HP[0], NULL, memory_order_relaxed);
-    atomic_store_explicit(&me->HP[1], NULL, memory_order_relaxed);
-    me->next = NULL;
+    for (size_t i = 0; i < LFQ_POOL_SLAB_NODES; i++)
+    {
+        void *next = (i + 1 < LFQ_POOL_SLAB_NODES) ? slab->objects + (i + 1) * cls->size : NULL;
+        atomic_init(pool_link(cls, slab->objects + i * cls->size), next);
+    }
+
+    pool_slab_t *oldhead = atomic_load_explicit(&cls->slabs, memory_order_relaxed);
+    do
+    {
+        slab->next = oldhead;
+    } while (!atomic_compare_exchange_weak_explicit(&cls->slabs, &oldhead, slab,
+                                                    memory_order_release, memory_order_relaxed));
 
-    return me;
+    atomic_fetch_add_explicit(&g_poolSlabs, 1, memory_order_relaxed);
+    return slab;
 }
 
-static unsigned HPRecord_free(hp_record_t *myhprec)
+static void pool_cache_flush_stats(pool_cache_t *cache)
 {
-    if (!myhprec)
+    if (cache->hits)
     {
-        return 0;
+        atomic_fetch_add_explicit(&g_poolHits, cache->hits, memory_order_relaxed);
+        cache->hits = 0;
     }
-
-    unsigned node_count = rlist_delete(myhprec->rlist);
-    free(myhprec);
-    return node_count;
 }
 
-static unsigned HPRecord_freeAll(void)
+static bool pool_cache_refill(pool_class_t *cls, pool_cache_t *cache)
 {
-    hp_record_t *curr_hprec = g_HPRecordHead;
-    hp_record_t *next_hprec = NULL;
+    atomic_fetch_add_explicit(&g_poolMisses, 1, memory_order_relaxed);
+    pool_cache_flush_stats(cache);
 
-    unsigned total_node_count = 0;
+    size_t want = atomic_load_explicit(&g_nodeCacheSize, memory_order_relaxed) >> 1;
+    if (want == 0)
+    {
+        want = 1;
+    }
 
-    while (curr_hprec)
+    size_t taken = 0;
+    void *list = overflow_take(cls, want, &taken);
+    if (list)
     {
-        next_hprec = curr_hprec->next;
-        total_node_count = total_node_count + HPRecord_free(curr_hprec);
-        curr_hprec = next_hprec;
+        cache->head = list;
+        cache->count = taken;
+        return true;
     }
 
-    g_HPRecordHead = NULL;
+    /*a fresh slab starts out in this thread's cache; its objects may later spill to others through the overflow list*/
+    pool_slab_t *slab = pool_slab_allocate(cls);
+    if (!slab)
+    {
+        return false;
+    }
 
-    return total_node_count;
+    cache->head = slab->objects;
+    cache->count = LFQ_POOL_SLAB_NODES;
+    return true;
 }
 
-static void HPRecord_push(hp_record_t *myhprec)
+static void pool_cache_spill(pool_class_t *cls, pool_cache_t *cache, size_t keep)
 {
-    hp_record_t *oldhead = atomic_load_explicit(&g_HPRecordHead, memory_order_relaxed);
-    do
+    if (cache->count <= keep)
     {
-        myhprec->next = oldhead;
-    } while (!atomic_compare_exchange_weak_explicit(&g_HPRecordHead, &oldhead, myhprec,
-                                                    memory_order_acq_rel, memory_order_acquire));
-}
+        return;
+    }
 
-static hp_record_t* HPRecord_tryReuse(void) 
-{
-    hp_record_t *hprec = NULL;
-    for (hprec = atomic_load_explicit(&g_HPRecordHead, memory_order_seq_cst); hprec != NULL; hprec = hprec->next)
+    void *first = cache->head;
+    void *last = first;
+    for (size_t i = keep + 1; i < cache->count; i++)
     {
-        if (atomic_load_explicit(&hprec->active, memory_order_seq_cst))
-        {
-            continue;
-        }
-
-        bool expected = false;
-        if (!atomic_compare_exchange_strong_explicit(&hprec->active, &expected, true, memory_order_seq_cst, memory_order_seq_cst))
-        {
-            /*TAS failed, the lock was already held by another thread.*/
-            continue;
-        }
-
-        return hprec;
+        last = pool_chain_next(cls, last);
     }
 
-    return NULL;
+    cache->head = pool_chain_next(cls, last);
+    cache->count = keep;
+    overflow_push(cls, first, last);
 }
 
-static void HPRecord_deactivate(hp_record_t *myhprec)
+/*The calling thread's cache of class idx, emptied if LFQueue_pool_release() freed its slabs since*/
+static inline pool_cache_t *pool_thread_cache(unsigned idx)
 {
-    atomic_store_explicit(&myhprec->active, false, memory_order_release);
-
-    for (unsigned i = 0; i < K; i++)
+    pool_cache_t *cache = &g_threadPoolCaches[idx];
+    unsigned generation = atomic_load_explicit(&g_poolGeneration, memory_order_relaxed);
+    if (cache->generation != generation)
     {
-        atomic_store_explicit(&myhprec->HP[i], NULL, memory_order_release);
+        cache->head = NULL;
+        cache->count = 0;
+        cache->hits = 0;
+        cache->generation = generation;
     }
+    return cache;
 }
 
-static inline hp_record_t *getThreadHPRecord(void)
+static void *pool_alloc(unsigned idx)
 {
-    if (g_threadHPRecord)
-    {
-        return g_threadHPRecord;
-    }
-
-    g_threadHPRecord = HPRecord_tryReuse();
-    if (!g_threadHPRecord)
+    pool_class_t *cls = &g_poolClasses[idx];
+    pool_cache_t *cache = pool_thread_cache(idx);
+    if (cache->head)
     {
-        g_threadHPRecord = HPRecord_allocate();
-        if (!g_threadHPRecord)
+        /*publish now and then so that LFQueue_pool_get_stats() sees running threads*/
+        if (++cache->hits >= LFQ_POOL_STATS_FLUSH)
         {
-            LFQueue_error_callback("%s: HPRecord_allocate() failed\n", __func__);
-            return NULL;
+            pool_cache_flush_stats(cache);
         }
-        HPRecord_push(g_threadHPRecord);
+    }
+    else if (!pool_cache_refill(cls, cache))
+    {
+        return NULL;
     }
 
-    atomic_fetch_add_explicit(&g_numOfHPRecord, K, memory_order_relaxed);
-    update_retireThreshold();
-    return g_threadHPRecord;
+    void *object = cache->head;
+    cache->head = pool_chain_next(cls, object);
+    cache->count--;
+    return object;
 }
 
-void LFQueue_cleanup_thread(void)
+static void pool_free(unsigned idx, void *object)
 {
-    hp_record_t *myhprec = getThreadHPRecord();
-    if (!myhprec)
+    pool_class_t *cls = &g_poolClasses[idx];
+    pool_cache_t *cache = pool_thread_cache(idx);
+    pool_chain_link(cls, object, cache->head);
+    cache->head = object;
+    cache->count++;
+
+    size_t cache_size = atomic_load_explicit(&g_nodeCacheSize, memory_order_relaxed);
+    if (cache->count > cache_size)
     {
-        return;
+        pool_cache_spill(cls, cache, cache_size >> 1);
     }
-
-    HPRecord_deactivate(myhprec);
-    g_threadHPRecord = NULL;
-    atomic_fetch_sub_explicit(&g_numOfHPRecord, K, memory_order_relaxed);
-    update_retireThreshold();
 }
 
-typedef struct plist_entry
-{
-    node_t *node;
-    struct plist_entry *next;
-
-} plist_entry_t;
-struct plist
+static inline node_t *node_alloc(void)
 {
-    plist_entry_t **table;
-    unsigned count;
-    unsigned size;
-};
+    return pool_alloc(0);
+}
 
-static inline uintptr_t plist_hash(uintptr_t key)
+static inline void node_free(node_t *node)
 {
-    key = ~key + (key << 15); /*Shift left and add complement*/
-    key = key ^ (key >> 12);  /*XOR with shifted right*/
-    key = key + (key << 2);   /*Shift left and add*/
-    key = key ^ (key >> 4);   /*XOR with shifted right*/
-    key = key * 2057;         /*Multiply by a prime number*/
-    key = key ^ (key >> 16);  /*XOR with shifted right*/
-    return key;
+    pool_free(0, node);
 }
-struct plist *plist_init(unsigned size)
-{
-
-    struct plist *me = malloc(sizeof(struct plist));
-    if (!me)
-    {
-        return NULL;
-    }
 
-    me->table = calloc(size, sizeof(plist_entry_t *));
-    if (!me->table)
+static void node_cache_flush(void)
+{
+    for (unsigned i = 0; i < LFQ_POOL_CLASSES; i++)
     {
-        free(me);
-        return NULL;
+        pool_cache_t *cache = pool_thread_cache(i);
+        pool_cache_flush_stats(cache);
+        pool_cache_spill(&g_poolClasses[i], cache, 0);
     }
+}
+#else
+static inline node_t *node_alloc(void)
+{
+#if LFQ_NODE_PADDED
+    return aligned_alloc(CACHE_LINE_SIZE, sizeof(struct node));
+#else
+    return malloc(sizeof(struct node));
+#endif
+}
 
-    me->count = 0;
-    me->size = size;
-
-    return me;
+static inline void node_free(node_t *node)
+{
+    free(node);
 }
 
-void plist_free(struct plist *me)
+static inline void node_cache_flush(void)
 {
-    if (!me)
-    {
-        return;
-    }
+}
+#endif
 
-    for (unsigned i = 0; i < me->size; i++)
+/*the class serving size, or LFQ_POOL_CLASSES if it is too big for the pool*/
+static inline unsigned pool_class_of(size_t size)
+{
+    unsigned idx = 1;
+    for (size_t class_size = 32; idx < LFQ_POOL_CLASSES; idx++, class_size <<= 1)
     {
-        plist_entry_t *curr = me->table[i];
-        while (curr)
+        if (size <= class_size)
         {
-            plist_entry_t *prev = curr;
-            curr = curr->next;
-            free(prev);
+            break;
         }
     }
-
-    free(me->table);
-    free(me);
+    return idx;
 }
 
-void plist_insert(struct plist *me, node_t *node)
+_Static_assert((32u << (LFQ_POOL_CLASSES - 2)) == LFQ_POOL_MAX_OBJECT, "the last class serves LFQ_POOL_MAX_OBJECT");
+
+void *LFQueue_pool_alloc(size_t size)
 {
-    if (!me || !node)
+    if (size == 0)
     {
-        return;
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return NULL;
     }
 
-    unsigned index = (unsigned)(plist_hash((uintptr_t)node) % me->size);
-    plist_entry_t *entry = malloc(sizeof(plist_entry_t));
-    if (!entry)
+#if LFQ_NODE_POOL
+    unsigned idx = pool_class_of(size);
+    if (idx < LFQ_POOL_CLASSES)
     {
-        return;
+        return pool_alloc(idx);
     }
-
-    entry->node = node;
-    entry->next = me->table[index];
-    me->table[index] = entry;
-    me->count++;
+#endif
+    return malloc(size);
 }
 
-int plist_lookup(struct plist *me, node_t *node)
+void LFQueue_pool_free(void *object, size_t size)
 {
-    if (!me || !node)
+    if (!object)
     {
-        return 0;
+        return;
     }
 
-    unsigned index = (unsigned)(plist_hash((uintptr_t)node) % me->size);
-    plist_entry_t *curr = me->table[index];
-    while (curr)
+#if LFQ_NODE_POOL
+    unsigned idx = pool_class_of(size);
+    if (idx < LFQ_POOL_CLASSES)
     {
-        if (curr->node == node)
-        {
-            return 1;
-        }
-        curr = curr->next;
+        pool_free(idx, object);
+        return;
     }
-
-    return 0;
+#else
+    (void)size;
+#endif
+    free(object);
 }
 
-void Scan(hp_record_t *myhprec)
+int LFQueue_pool_set_cache_size(size_t size)
 {
-    unsigned current_H = atomic_load_explicit(&g_numOfHPRecord, memory_order_relaxed);
-    unsigned size = current_H + (current_H >> 1); /*approximately 1.5H*/
     if (size == 0)
     {
-        LFQueue_error_callback("plist size shouldn't be zero. Set it to default value\n");
-        const unsigned default_size = 100;
-        size = default_size;
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
     }
 
-    struct plist *plist = plist_init(size);
-    if (!plist)
-    {
-        LFQueue_error_callback("plist_init() failed");
-        return;
-    }
+#if LFQ_NODE_POOL
+    atomic_store_explicit(&g_nodeCacheSize, size, memory_order_relaxed);
+#endif
+    return 0;
+}
 
-    hp_record_t *hprec = atomic_load_explicit(&g_HPRecordHead, memory_order_acquire);
-    while (hprec != NULL)
+int LFQueue_pool_get_stats(lfq_pool_stats_t *stats)
+{
+    if (!stats)
     {
-        for (unsigned i = 0; i < K; i++)
-        {
-            node_t *hptr = atomic_load_explicit(&hprec->HP[i], memory_order_acquire);
-            if (hptr != NULL)
-            {
-                plist_insert(plist, hptr);
-            }
-        }
-        hprec = hprec->next;
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
     }
 
-    node_t *tmplist = myhprec->rlist;
-    myhprec->rlist = NULL;
-    myhprec->rcount = 0;
-    node_t *node = rlist_pop(&tmplist);
-    while (node != NULL)
+#if LFQ_NODE_POOL
+    for (unsigned i = 0; i < LFQ_POOL_CLASSES; i++)
     {
-        if (plist_lookup(plist, node))
-        {
-            rlist_push(&myhprec->rlist, node);
-            myhprec->rcount++;
-        }
-        else
-        {
-            /*PrepareForReuse(node);*/
-            free(node);
-        }
-        node = rlist_pop(&tmplist);
+        pool_cache_flush_stats(pool_thread_cache(i));
     }
-
-    plist_free(plist);
+    stats->hits = atomic_load_explicit(&g_poolHits, memory_order_relaxed);
+    stats->misses = atomic_load_explicit(&g_poolMisses, memory_order_relaxed);
+    stats->slabs = atomic_load_explicit(&g_poolSlabs, memory_order_relaxed);
+#else
+    stats->hits = stats->misses = stats->slabs = 0;
+#endif
+    return 0;
 }
 
-void HelpScan(hp_record_t *myhprec)
+void LFQueue_pool_release(void)
 {
-    hp_record_t *hprec = NULL;
-    for (hprec = atomic_load_explicit(&g_HPRecordHead, memory_order_acquire); hprec != NULL; hprec = hprec->next)
+#if LFQ_NODE_POOL
+    for (unsigned i = 0; i < LFQ_POOL_CLASSES; i++)
     {
-
-        if (atomic_load_explicit(&hprec->active, memory_order_acquire))
-        {
-            continue;
-        }
-
-        bool expected = false;
-        if (!atomic_compare_exchange_strong_explicit(&hprec->active, &expected, true, memory_order_acq_rel, memory_order_relaxed))
-        {
-            /*TAS failed, the lock was already held by another thread.*/
-            continue;
-        }
-
-        while (hprec->rcount > 0)
+        pool_slab_t *slab = atomic_exchange_explicit(&g_poolClasses[i].slabs, NULL, memory_order_acquire);
+        while (slab)
         {
-            node_t *node = rlist_pop(&hprec->rlist);
-            hprec->rcount--;
-            rlist_push(&myhprec->rlist, node);
-            myhprec->rcount++;
-            if (myhprec->rcount >= atomic_load_explicit(&g_retireThreshold, memory_order_relaxed))
-            {
-                Scan(myhprec);
-            }
+            pool_slab_t *next = slab->next;
+            free(slab);
+            slab = next;
         }
 
-        atomic_store_explicit(&hprec->active, false, memory_order_release);
+        atomic_store_explicit(&g_poolClasses[i].overflow, NULL, memory_order_relaxed);
     }
+
+    /*every thread's cache, this one's included, points into freed slabs: drop them on their next use*/
+    atomic_fetch_add_explicit(&g_poolGeneration, 1, memory_order_relaxed);
+    atomic_store_explicit(&g_poolHits, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_poolMisses, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_poolSlabs, 0, memory_order_relaxed);
+#endif
 }
 
-void retireNode(hp_record_t *myhprec, node_t *node)
+/*
+ * Retired lists reuse next. A stale reader may still load next of a node that
+ * has left the queue, so the store is atomic, and a list ends in a sentinel
+ * rather than NULL: next of a retired node is never NULL, hence a late enqueuer
+ * can never link an item behind it.
+ */
+static node_t g_rlistEnd;
+#if !LFQ_SOJOURN && !LFQ_NODE_PADDED
+_Static_assert(sizeof(node_t) == 2 * sizeof(void *), "a node is its data and next, nothing more");
+#endif
+#define RLIST_END (&g_rlistEnd)
+
+static inline void rlist_push(node_t **head, node_t *node)
 {
-    rlist_push(&myhprec->rlist, node);
-    myhprec->rcount++;
-    if (myhprec->rcount >= atomic_load_explicit(&g_retireThreshold, memory_order_relaxed))
-    {
-        Scan(myhprec);
-        HelpScan(myhprec);
-    }
+    atomic_store_explicit(&node->next, *head ? *head : RLIST_END, memory_order_relaxed);
+    *head = node;
 }
 
-int queue_attr_init(queue_attr_t* attr) {
-    if (!attr) {
-        LFQueue_error_callback("%s: invalid input\n", __func__);
-        return -1;
-    }
-    attr->enqueueCallback = NULL;
-    attr->onEmptyCallback = NULL;
-    return 0;
+static inline node_t *rlist_next(node_t *node)
+{
+    node_t *next = atomic_load_explicit(&node->next, memory_order_relaxed);
+    return next == RLIST_END ? NULL : next;
 }
 
-int LFQueue_init(struct LFQueue* me, queue_attr_t* attr)
+static inline node_t *rlist_pop(node_t **head)
 {
-    if (!me)
+    if (!head || !(*head))
     {
-        LFQueue_error_callback("%s: invalid input\n", __func__);
-        return -1;
-    }
 
-    node_t *dummy = malloc(sizeof(struct node));
-    if (!dummy)
-    {
-        LFQueue_error_callback("%s: malloc() for dummy node failed\n", __func__);
-        return -1;
+        return NULL;
     }
 
-    atomic_init(&dummy->next, NULL);
-    atomic_init(&me->head, dummy);
-    atomic_init(&me->tail, dummy);
-
-    if (!attr) {
-        queue_attr_init(&me->attr);
-    }
-    else {
-        me->attr = *attr;
-    }
+    node_t *node_to_return = *head;
+    *head = rlist_next(node_to_return);
 
-    return 0;
+    return node_to_return;
 }
 
-int LFQueue_destroy(struct LFQueue *me)
+unsigned rlist_delete(node_t *head)
 {
-    if (!me)
+    if (!head)
     {
-        LFQueue_error_callback("%s: invalid input\n", __func__);
-        return -1;
+        return 0;
     }
 
-    node_t *curr = atomic_load_explicit(&me->head, memory_order_relaxed);
-    node_t *next = NULL;
-    while (curr)
+    unsigned node_count = 0;
+
+    node_t *curr_node = head;
+    node_t *next_node = NULL;
+    while (curr_node)
     {
-        next = atomic_load_explicit(&curr->next, memory_order_relaxed);
-        free(curr);
-        curr = next;
+        node_count++;
+        next_node = rlist_next(curr_node);
+        node_free(curr_node);
+        curr_node = next_node;
     }
 
-    me->head = me->tail = NULL;
+    return node_count;
+}
 
-    HPRecord_freeAll();
+/*
+ * Segment of LFQ_BACKEND_SEGMENT. Producers and consumers claim slots with a
+ * fetch-and-add on their index, so they only meet on a CAS when a segment fills
+ * up. Drained segments are retired whole through the hazard pointer records.
+ */
+#define SEG_EMPTY (0ULL)
+#define SEG_TAKEN (1ULL) /*a consumer got there first, the producer retries elsewhere*/
+#define SEG_FULL(data) (((unsigned long long)(unsigned)(data) << 32) | 2ULL)
+#define SEG_DATA(slot) ((int)(unsigned)((slot) >> 32))
 
-    return 0;
-}
+typedef struct lfq_segment
+{
+    lfq_block_t block;
+    alignas(CACHE_LINE_SIZE) atomic_size_t enq_idx;
+    alignas(CACHE_LINE_SIZE) atomic_size_t deq_idx;
+    alignas(CACHE_LINE_SIZE) _Atomic(struct lfq_segment*) next;
+    atomic_ullong slots[LFQ_SEGMENT_SIZE];
+#if LFQ_SOJOURN
+    unsigned long long stamps[LFQ_SEGMENT_SIZE];
+#endif
+} lfq_segment_t;
 
-lfq_err_t enqueueLF(struct LFQueue *me, int data)
+/*A block comes first in whatever it heads, so freeing the block frees the whole object*/
+static inline void block_reclaim(lfq_block_t *block)
 {
-    if (!me)
+    if (block->reclaim)
+    {
+        block->reclaim(block);
+    }
+    else
+    {
+        free(block);
+    }
+}
+
+/*Push onto a record's retired lists; the first item pushed stays the tail*/
+static inline void record_push_node(hp_record_t *hprec, node_t *node)
+{
+    if (!hprec->rlist)
+    {
+        hprec->rlist_tail = node;
+    }
+    rlist_push(&hprec->rlist, node);
+    hprec->rcount++;
+}
+
+static inline void record_push_block(hp_record_t *hprec, lfq_block_t *block)
+{
+    if (!hprec->block_rlist)
+    {
+        hprec->block_rlist_tail = block;
+    }
+    block->retired_next = hprec->block_rlist;
+    hprec->block_rlist = block;
+    hprec->block_rcount++;
+}
+
+static unsigned block_rlist_delete(lfq_block_t *head)
+{
+    unsigned count = 0;
+    while (head)
+    {
+        lfq_block_t *next = head->retired_next;
+        block_reclaim(head);
+        head = next;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Log-linear histogram: values below 2^LFQ_HIST_SUB_BITS get their own bucket,
+ * above that every power of two is split into 2^LFQ_HIST_SUB_BITS equal buckets.
+ */
+#define HIST_SUB_COUNT (1u << LFQ_HIST_SUB_BITS)
+
+static inline unsigned hist_bucket(unsigned long long v)
+{
+    if (v < HIST_SUB_COUNT)
+    {
+        return (unsigned)v;
+    }
+    unsigned e = 63 - (unsigned)__builtin_clzll(v);
+    unsigned sub = (unsigned)(v >> (e - LFQ_HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return ((e - LFQ_HIST_SUB_BITS + 1) << LFQ_HIST_SUB_BITS) + sub;
+}
+
+/*largest value that falls into bucket idx*/
+static unsigned long long hist_bucket_high(unsigned idx)
+{
+    if (idx < HIST_SUB_COUNT)
+    {
+        return idx;
+    }
+    unsigned shift = (idx >> LFQ_HIST_SUB_BITS) - 1;
+    unsigned long long low = (unsigned long long)(HIST_SUB_COUNT + (idx & (HIST_SUB_COUNT - 1))) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+void LFQueue_histogram_merge(lfq_histogram_t *dst, const lfq_histogram_t *src)
+{
+    if (!dst || !src)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return;
+    }
+
+    if (src->count == 0)
+    {
+        return;
+    }
+    if (dst->count == 0 || src->min_ns < dst->min_ns)
+    {
+        dst->min_ns = src->min_ns;
+    }
+    if (src->max_ns > dst->max_ns)
+    {
+        dst->max_ns = src->max_ns;
+    }
+    dst->count += src->count;
+    dst->total_ns += src->total_ns;
+    for (unsigned i = 0; i < LFQ_HIST_BUCKETS; i++)
+    {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+unsigned long long LFQueue_histogram_percentile(const lfq_histogram_t *hist, double p)
+{
+    if (!hist || p < 0.0 || p > 1.0)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+
+    size_t rank = (size_t)(p * (double)hist->count + 0.999999);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    size_t seen = 0;
+    for (unsigned i = 0; i < LFQ_HIST_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+        {
+            unsigned long long high = hist_bucket_high(i);
+            return high < hist->max_ns ? high : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+#if LFQ_SOJOURN
+/*
+ * Per-record sojourn histogram. The owning thread is the only writer, so it
+ * bumps the counters with relaxed load + store; LFQueue_get_sojourn() reads them.
+ */
+struct lfq_sojourn
+{
+    atomic_size_t count;
+    atomic_ullong min_ns;
+    atomic_ullong max_ns;
+    atomic_ullong total_ns;
+    atomic_size_t buckets[LFQ_HIST_BUCKETS];
+};
+
+static inline void sojourn_record(struct lfq_sojourn *hist, unsigned long long stamp, unsigned long long now)
+{
+    unsigned long long ns = now > stamp ? now - stamp : 0;
+    atomic_size_t *bucket = &hist->buckets[hist_bucket(ns)];
+
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&hist->count, atomic_load_explicit(&hist->count, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&hist->total_ns, atomic_load_explicit(&hist->total_ns, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+    if (ns < atomic_load_explicit(&hist->min_ns, memory_order_relaxed))
+    {
+        atomic_store_explicit(&hist->min_ns, ns, memory_order_relaxed);
+    }
+    if (ns > atomic_load_explicit(&hist->max_ns, memory_order_relaxed))
+    {
+        atomic_store_explicit(&hist->max_ns, ns, memory_order_relaxed);
+    }
+}
+#endif
+
+/*
+ * Hazard pointer domain: the record list and retire threshold that a set of
+ * queues share. Every queue gets a private domain unless queue_attr_t.domain
+ * names a shared one, so Scan() only walks records of threads that touched
+ * the queues of its own domain. Live domains are kept in a registry so that
+ * per-thread slots can tell whether the domain behind them still exists.
+ */
+/*
+ * Records live in cache-line-aligned slabs, each twice the size of the one
+ * before up to HP_SLAB_MAX, with one bit per slot in used. A thread takes a
+ * record by setting its bit and gives it back by clearing it, so finding a
+ * free record is a bit scan, and Scan() reads the slots of a slab in address
+ * order instead of chasing a pointer per record.
+ */
+#define HP_SLAB_FIRST (4)
+#define HP_SLAB_MAX (64) /*bits in used*/
+
+struct hp_record_slab
+{
+    atomic_ullong used;    /*bit i: records[i] is held by a thread, or by HelpScan()*/
+    atomic_ullong touched; /*bit i: records[i] has been handed out at least once*/
+    unsigned capacity;
+    struct hp_record_slab *next; /*older, smaller slab; fixed once published*/
+    hp_record_t records[];
+};
+
+struct hp_domain
+{
+    _Atomic(struct hp_record_slab*) slabs; /*newest first*/
+    atomic_uint numOfHPRecord; /*total hazard pointers across all threads of this domain*/
+    atomic_uint slabRecords; /*records in all slabs, reserved before a slab is allocated*/
+    atomic_uint releasing; /*threads giving a record back outside g_domainRegistryLock; destroy waits for them*/
+    atomic_uint retireThreshold;
+    atomic_uint epoch; /*global epoch for LFQ_RECLAIM_EBR queues*/
+    _Atomic(struct lfq_reclaimer*) reclaimer; /*NULL unless hp_domain_start_reclaimer()*/
+    pthread_mutex_t reclaimer_lock;
+    unsigned long long id;
+    struct hp_domain *registry_next;
+};
+
+_Static_assert(LFQ_HP_THREAD_SLOTS % LFQ_HP_THREAD_WAYS == 0, "the slots split evenly into sets");
+_Thread_local hp_thread_slot_t hp_thread_slots[LFQ_HP_THREAD_SLOTS];
+
+static pthread_mutex_t g_domainRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static hp_domain_t *g_domainRegistry = NULL;
+static atomic_ullong g_domainNextId = ATOMIC_VAR_INIT(1);
+
+static void update_retireThreshold(hp_domain_t *domain)
+{
+    unsigned current_H = atomic_load_explicit(&domain->numOfHPRecord, memory_order_relaxed);
+    unsigned expected_R = atomic_load_explicit(&domain->retireThreshold, memory_order_relaxed);
+    unsigned desired_R = current_H << 2; /*H * (1+c), where c = 3*/
+
+    int retry_count = 0;
+    const int max_retires = 10;
+    while (!atomic_compare_exchange_weak_explicit(&domain->retireThreshold, &expected_R, desired_R,
+                                                  memory_order_acq_rel, memory_order_acquire))
+    {
+        if (++retry_count >= max_retires)
+        {
+            break;
+        }
+
+        current_H = atomic_load_explicit(&domain->numOfHPRecord, memory_order_relaxed);
+        desired_R = current_H << 2;
+    }
+}
+
+static inline unsigned long long hp_slab_mask(const struct hp_record_slab *slab)
+{
+    return slab->capacity == HP_SLAB_MAX ? ~0ULL : (1ULL << slab->capacity) - 1;
+}
+
+static void HPRecord_init(hp_record_t *me, struct hp_record_slab *slab, unsigned slot, hp_domain_t *domain)
+{
+    me->rlist = NULL;
+    me->rlist_tail = NULL;
+    me->rcount = 0;
+    me->block_rlist = NULL;
+    me->block_rlist_tail = NULL;
+    me->block_rcount = 0;
+    atomic_init(&me->HP[0], NULL);
+    atomic_init(&me->HP[1], NULL);
+    atomic_init(&me->epoch, 0);
+    for (unsigned i = 0; i < LFQ_EBR_EPOCHS; i++)
+    {
+        me->limbo[i] = NULL;
+        me->limbo_epoch[i] = 0;
+    }
+    me->limbo_count = 0;
+#if LFQ_STATS
+    memset(&me->stats, 0, sizeof(me->stats));
+#endif
+    me->domain = domain;
+    me->slab = slab;
+    me->slot = slot;
+}
+
+static unsigned HPRecord_free(hp_record_t *myhprec)
+{
+    if (!myhprec)
+    {
+        return 0;
+    }
+
+    unsigned node_count = rlist_delete(myhprec->rlist);
+    for (unsigned i = 0; i < LFQ_EBR_EPOCHS; i++)
+    {
+        node_count += rlist_delete(myhprec->limbo[i]);
+    }
+    block_rlist_delete(myhprec->block_rlist);
+#if LFQ_SOJOURN
+    free(myhprec->sojourn);
+#endif
+    return node_count;
+}
+
+/*Take a free slot of the slab, NULL if all are held*/
+static hp_record_t *hp_slab_take(struct hp_record_slab *slab)
+{
+    unsigned long long mask = hp_slab_mask(slab);
+    unsigned long long free_bits = ~atomic_load_explicit(&slab->used, memory_order_relaxed) & mask;
+    while (free_bits)
+    {
+        unsigned i = (unsigned)__builtin_ctzll(free_bits);
+        unsigned long long bit = 1ULL << i;
+        unsigned long long prev = atomic_fetch_or_explicit(&slab->used, bit, memory_order_seq_cst);
+        if (!(prev & bit))
+        {
+            atomic_fetch_or_explicit(&slab->touched, bit, memory_order_relaxed);
+            return &slab->records[i];
+        }
+        free_bits = ~prev & mask;
+    }
+
+    return NULL;
+}
+
+/*A new slab with its first slot already taken by the caller; NULL at LFQ_HP_MAX_RECORDS*/
+static hp_record_t *HPRecord_allocate(hp_domain_t *domain)
+{
+    struct hp_record_slab *head = atomic_load_explicit(&domain->slabs, memory_order_acquire);
+    unsigned capacity = head ? head->capacity << 1 : HP_SLAB_FIRST;
+    if (capacity > HP_SLAB_MAX)
+    {
+        capacity = HP_SLAB_MAX;
+    }
+
+    /*reserve the slab's records first, so that concurrent allocations cannot overshoot the cap together*/
+    unsigned total = atomic_load_explicit(&domain->slabRecords, memory_order_relaxed);
+    do
+    {
+        if (total >= LFQ_HP_MAX_RECORDS)
+        {
+            LFQueue_error_callback("%s: %u records allocated, LFQ_HP_MAX_RECORDS reached\n", __func__, total);
+            return NULL;
+        }
+        if (capacity > LFQ_HP_MAX_RECORDS - total)
+        {
+            capacity = LFQ_HP_MAX_RECORDS - total;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&domain->slabRecords, &total, total + capacity,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    struct hp_record_slab *slab = aligned_alloc(CACHE_LINE_SIZE,
+                                                sizeof(struct hp_record_slab) + capacity * sizeof(hp_record_t));
+    if (!slab)
+    {
+        atomic_fetch_sub_explicit(&domain->slabRecords, capacity, memory_order_relaxed);
+        return NULL;
+    }
+
+    atomic_init(&slab->used, 1ULL);
+    atomic_init(&slab->touched, 1ULL);
+    slab->capacity = capacity;
+    for (unsigned i = 0; i < capacity; i++)
+    {
+        HPRecord_init(&slab->records[i], slab, i, domain);
+#if LFQ_SOJOURN
+        slab->records[i].sojourn = calloc(1, sizeof(struct lfq_sojourn));
+        if (!slab->records[i].sojourn)
+        {
+            while (i-- > 0)
+            {
+                free(slab->records[i].sojourn);
+            }
+            free(slab);
+            atomic_fetch_sub_explicit(&domain->slabRecords, capacity, memory_order_relaxed);
+            return NULL;
+        }
+        atomic_store_explicit(&slab->records[i].sojourn->min_ns, ULLONG_MAX, memory_order_relaxed);
+#endif
+    }
+
+    slab->next = head;
+    while (!atomic_compare_exchange_weak_explicit(&domain->slabs, &head, slab,
+                                                  memory_order_acq_rel, memory_order_acquire))
+    {
+        slab->next = head;
+    }
+
+    return &slab->records[0];
+}
+
+static unsigned HPRecord_freeAll(hp_domain_t *domain)
+{
+    struct hp_record_slab *slab = atomic_exchange_explicit(&domain->slabs, NULL, memory_order_acquire);
+
+    unsigned total_node_count = 0;
+
+    while (slab)
+    {
+        struct hp_record_slab *next = slab->next;
+        for (unsigned i = 0; i < slab->capacity; i++)
+        {
+            total_node_count = total_node_count + HPRecord_free(&slab->records[i]);
+        }
+        free(slab);
+        slab = next;
+    }
+
+    return total_node_count;
+}
+
+static hp_record_t* HPRecord_tryReuse(hp_domain_t *domain) 
+{
+    struct hp_record_slab *slab = NULL;
+    for (slab = atomic_load_explicit(&domain->slabs, memory_order_acquire); slab != NULL; slab = slab->next)
+    {
+        hp_record_t *hprec = hp_slab_take(slab);
+        if (hprec)
+        {
+            return hprec;
+        }
+    }
+
+    return NULL;
+}
+
+/*Claim an inactive record for HelpScan(); false if some thread holds it*/
+static inline bool HPRecord_tryLock(hp_record_t *hprec)
+{
+    unsigned long long bit = 1ULL << hprec->slot;
+    return !(atomic_fetch_or_explicit(&hprec->slab->used, bit, memory_order_acq_rel) & bit);
+}
+
+static inline void HPRecord_unlock(hp_record_t *hprec)
+{
+    atomic_fetch_and_explicit(&hprec->slab->used, ~(1ULL << hprec->slot), memory_order_release);
+}
+
+static inline bool HPRecord_isActive(const hp_record_t *hprec)
+{
+    return (atomic_load_explicit(&hprec->slab->used, memory_order_relaxed) >> hprec->slot) & 1ULL;
+}
+
+static void HPRecord_deactivate(hp_record_t *myhprec)
+{
+    atomic_store_explicit(&myhprec->epoch, 0, memory_order_release);
+
+    for (unsigned i = 0; i < K; i++)
+    {
+        atomic_store_explicit(&myhprec->HP[i], NULL, memory_order_release);
+    }
+
+    /*last, so that the next owner's hazard pointers cannot be cleared by these stores*/
+    HPRecord_unlock(myhprec);
+}
+
+static void hp_fence_init(void);
+
+hp_domain_t *hp_domain_create(void)
+{
+    hp_fence_init();
+
+    hp_domain_t *domain = malloc(sizeof(hp_domain_t));
+    if (!domain)
+    {
+        LFQueue_error_callback("%s: malloc() failed\n", __func__);
+        return NULL;
+    }
+
+    atomic_init(&domain->slabs, NULL);
+    atomic_init(&domain->numOfHPRecord, 0);
+    atomic_init(&domain->slabRecords, 0);
+    atomic_init(&domain->releasing, 0);
+    atomic_init(&domain->retireThreshold, 0);
+    atomic_init(&domain->epoch, 0);
+    atomic_init(&domain->reclaimer, NULL);
+    pthread_mutex_init(&domain->reclaimer_lock, NULL);
+    domain->id = atomic_fetch_add_explicit(&g_domainNextId, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&g_domainRegistryLock);
+    domain->registry_next = g_domainRegistry;
+    g_domainRegistry = domain;
+    pthread_mutex_unlock(&g_domainRegistryLock);
+
+    return domain;
+}
+
+static void reclaimer_stop(hp_domain_t *domain);
+
+int hp_domain_destroy(hp_domain_t *domain)
+{
+    if (!domain)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    /*while the domain is still registered, so that the reclaimer can give its record back*/
+    reclaimer_stop(domain);
+
+    pthread_mutex_lock(&g_domainRegistryLock);
+    hp_domain_t **link = &g_domainRegistry;
+    while (*link && *link != domain)
+    {
+        link = &(*link)->registry_next;
+    }
+    if (*link)
+    {
+        *link = domain->registry_next;
+    }
+    pthread_mutex_unlock(&g_domainRegistryLock);
+
+    /*a thread that found the domain live before the unlink may still be scanning its record*/
+    while (atomic_load_explicit(&domain->releasing, memory_order_acquire))
+    {
+        sched_yield();
+    }
+
+    HPRecord_freeAll(domain);
+    pthread_mutex_destroy(&domain->reclaimer_lock);
+    free(domain);
+
+    return 0;
+}
+
+/*Caller holds g_domainRegistryLock*/
+static bool hp_domain_is_live(const hp_thread_slot_t *slot)
+{
+    for (hp_domain_t *domain = g_domainRegistry; domain; domain = domain->registry_next)
+    {
+        if (domain == slot->domain && domain->id == slot->id)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scan(hp_record_t *myhprec);
+
+/*Give the slot's record back to its domain, unless the domain has been destroyed in the meantime*/
+static void hp_thread_slot_release(hp_thread_slot_t *slot)
+{
+    if (!slot->record)
+    {
+        return;
+    }
+
+    /*only the liveness check under the lock; releasing keeps the domain from being freed meanwhile*/
+    pthread_mutex_lock(&g_domainRegistryLock);
+    bool live = hp_domain_is_live(slot);
+    if (live)
+    {
+        atomic_fetch_add_explicit(&slot->domain->releasing, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_domainRegistryLock);
+
+    if (live)
+    {
+        /*free what is already safe; HelpScan() or the record's next owner takes over the rest*/
+        if (slot->record->rcount || slot->record->block_rcount)
+        {
+            Scan(slot->record);
+        }
+        HPRecord_deactivate(slot->record);
+        atomic_fetch_sub_explicit(&slot->domain->numOfHPRecord, K, memory_order_relaxed);
+        update_retireThreshold(slot->domain);
+        atomic_fetch_sub_explicit(&slot->domain->releasing, 1, memory_order_release);
+    }
+
+    slot->domain = NULL;
+    slot->id = 0;
+    slot->record = NULL;
+}
+
+/*
+ * Threads that exit without LFQueue_cleanup_thread() would keep their records
+ * held forever: nobody helps their retired nodes, and the retire threshold
+ * counts them. A thread that takes a record therefore sets a pthread key whose
+ * destructor runs the cleanup when the thread exits.
+ */
+static pthread_key_t g_threadExitKey;
+static pthread_once_t g_threadExitOnce = PTHREAD_ONCE_INIT;
+static bool g_threadExitKeyValid = false;
+static _Thread_local bool g_threadExitArmed = false;
+
+static void thread_exit_destructor(void *arg)
+{
+    (void)arg;
+    LFQueue_cleanup_thread();
+}
+
+static void thread_exit_key_create(void)
+{
+    g_threadExitKeyValid = pthread_key_create(&g_threadExitKey, thread_exit_destructor) == 0;
+    if (!g_threadExitKeyValid)
+    {
+        LFQueue_error_callback("%s: pthread_key_create() failed, call LFQueue_cleanup_thread() before exit\n", __func__);
+    }
+}
+
+static void thread_exit_arm(void)
+{
+    if (g_threadExitArmed)
+    {
+        return;
+    }
+
+    pthread_once(&g_threadExitOnce, thread_exit_key_create);
+    /*any non-NULL value, so that the destructor runs*/
+    if (g_threadExitKeyValid && pthread_setspecific(g_threadExitKey, &g_threadExitArmed) == 0)
+    {
+        g_threadExitArmed = true;
+    }
+}
+
+static void thread_exit_disarm(void)
+{
+    if (g_threadExitArmed)
+    {
+        pthread_setspecific(g_threadExitKey, NULL);
+        g_threadExitArmed = false;
+    }
+}
+
+static hp_record_t *hp_thread_slot_acquire(hp_domain_t *domain, hp_thread_slot_t *set)
+{
+    /*an empty way if there is one, else the least recently used (last) way, whose record goes back*/
+    unsigned way = LFQ_HP_THREAD_WAYS - 1;
+    for (unsigned i = 0; i < LFQ_HP_THREAD_WAYS; i++)
+    {
+        if (!set[i].record)
+        {
+            way = i;
+            break;
+        }
+    }
+    hp_thread_slot_release(&set[way]);
+    thread_exit_arm();
+
+    hp_record_t *myhprec = HPRecord_tryReuse(domain);
+    if (!myhprec)
+    {
+        myhprec = HPRecord_allocate(domain);
+        if (!myhprec)
+        {
+            LFQueue_error_callback("%s: HPRecord_allocate() failed\n", __func__);
+            return NULL;
+        }
+    }
+
+    atomic_fetch_add_explicit(&domain->numOfHPRecord, K, memory_order_relaxed);
+    update_retireThreshold(domain);
+
+    /*the new slot goes first, as the most recently used*/
+    memmove(&set[1], &set[0], way * sizeof(set[0]));
+    set[0].domain = domain;
+    set[0].id = domain->id;
+    set[0].record = myhprec;
+    return myhprec;
+}
+
+/*
+ * The per-thread slots form LFQ_HP_THREAD_SLOTS / LFQ_HP_THREAD_WAYS sets of
+ * LFQ_HP_THREAD_WAYS ways, kept in most recently used order, so domains whose
+ * ids collide share a set instead of evicting each other on every switch.
+ * hp_thread_record() in LFHazard.h inlines the check of the first way.
+ */
+static inline hp_record_t *getThreadHPRecord(hp_domain_t *domain)
+{
+    hp_thread_slot_t *set =
+        &hp_thread_slots[(domain->id & (LFQ_HP_THREAD_SLOTS / LFQ_HP_THREAD_WAYS - 1)) * LFQ_HP_THREAD_WAYS];
+    if (set[0].domain == domain && set[0].id == domain->id)
+    {
+        return set[0].record;
+    }
+
+    for (unsigned i = 1; i < LFQ_HP_THREAD_WAYS; i++)
+    {
+        if (set[i].domain == domain && set[i].id == domain->id)
+        {
+            hp_thread_slot_t hit = set[i];
+            memmove(&set[1], &set[0], i * sizeof(set[0]));
+            set[0] = hit;
+            return hit.record;
+        }
+    }
+
+    return hp_thread_slot_acquire(domain, set);
+}
+
+/*
+ * Hazard pointer snapshot used by Scan(). It is a flat, per-thread array that
+ * is sorted once per scan and then binary-searched for every retired node, so
+ * reclamation does no heap allocation once the buffer has grown to fit H.
+ */
+typedef struct
+{
+    node_t **slots;
+    size_t count;
+    size_t capacity;
+} hp_snapshot_t;
+
+static _Thread_local hp_snapshot_t g_threadSnapshot = {NULL, 0, 0};
+
+static bool hp_snapshot_reserve(hp_snapshot_t *snap, size_t capacity)
+{
+    if (capacity <= snap->capacity)
+    {
+        return true;
+    }
+
+    size_t new_capacity = snap->capacity ? snap->capacity : 16;
+    while (new_capacity < capacity)
+    {
+        new_capacity <<= 1;
+    }
+
+    node_t **slots = realloc(snap->slots, new_capacity * sizeof(node_t *));
+    if (!slots)
+    {
+        return false;
+    }
+
+    snap->slots = slots;
+    snap->capacity = new_capacity;
+    return true;
+}
+
+static void hp_snapshot_release(void)
+{
+    free(g_threadSnapshot.slots);
+    g_threadSnapshot.slots = NULL;
+    g_threadSnapshot.count = 0;
+    g_threadSnapshot.capacity = 0;
+}
+
+static void hp_snapshot_sift_down(node_t **slots, size_t root, size_t count)
+{
+    node_t *value = slots[root];
+    size_t child;
+    while ((child = 2 * root + 1) < count)
+    {
+        if (child + 1 < count && (uintptr_t)slots[child + 1] > (uintptr_t)slots[child])
+        {
+            child++;
+        }
+        if ((uintptr_t)slots[child] <= (uintptr_t)value)
+        {
+            break;
+        }
+        slots[root] = slots[child];
+        root = child;
+    }
+    slots[root] = value;
+}
+
+/*Sorted in place: qsort() may malloc a temporary buffer for larger arrays*/
+static void hp_snapshot_sort(hp_snapshot_t *snap)
+{
+    node_t **slots = snap->slots;
+    size_t count = snap->count;
+    if (count <= 16)
+    {
+        for (size_t i = 1; i < count; i++)
+        {
+            node_t *value = slots[i];
+            size_t j = i;
+            for (; j > 0 && (uintptr_t)slots[j - 1] > (uintptr_t)value; j--)
+            {
+                slots[j] = slots[j - 1];
+            }
+            slots[j] = value;
+        }
+        return;
+    }
+
+    for (size_t i = count / 2; i-- > 0;)
+    {
+        hp_snapshot_sift_down(slots, i, count);
+    }
+    for (size_t end = count - 1; end > 0; end--)
+    {
+        node_t *top = slots[0];
+        slots[0] = slots[end];
+        slots[end] = top;
+        hp_snapshot_sift_down(slots, 0, end);
+    }
+}
+
+static bool hp_snapshot_contains(const hp_snapshot_t *snap, const node_t *node)
+{
+    size_t lo = 0;
+    size_t hi = snap->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + ((hi - lo) >> 1);
+        if ((uintptr_t)snap->slots[mid] < (uintptr_t)node)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo < snap->count && snap->slots[lo] == node;
+}
+
+void LFQueue_cleanup_thread(void)
+{
+    thread_exit_disarm();
+    for (unsigned i = 0; i < LFQ_HP_THREAD_SLOTS; i++)
+    {
+        hp_thread_slot_release(&hp_thread_slots[i]);
+    }
+
+    node_cache_flush();
+    hp_snapshot_release();
+}
+
+/*
+ * Store-load fence. ThreadSanitizer does not model fences (and warns about
+ * them), so sanitized builds use a seq_cst RMW on a thread-private word.
+ */
+static inline void full_fence(void)
+{
+#if defined(__SANITIZE_THREAD__)
+    static _Thread_local atomic_int fence_word;
+    atomic_fetch_add_explicit(&fence_word, 0, memory_order_seq_cst);
+#else
+    atomic_thread_fence(memory_order_seq_cst);
+#endif
+}
+
+/*
+ * A reader that publishes a hazard pointer must not load the source again
+ * before the publish is visible, or Scan() can miss it: a store-load fence on
+ * every protect. With LFQ_ASYMMETRIC_FENCE on Linux readers only stop the
+ * compiler, and Scan() runs membarrier(2), which makes every running thread of
+ * the process execute a full barrier. ThreadSanitizer cannot see that, and
+ * kernels without MEMBARRIER_CMD_PRIVATE_EXPEDITED refuse the registration;
+ * both keep the reader-side fence.
+ */
+#if LFQ_ASYMMETRIC_FENCE
+static atomic_bool g_hpAsymmetric = ATOMIC_VAR_INIT(false);
+#endif
+static pthread_once_t g_hpFenceOnce = PTHREAD_ONCE_INIT;
+
+static void hp_fence_setup(void)
+{
+#if LFQ_ASYMMETRIC_FENCE && defined(__linux__) && !defined(__SANITIZE_THREAD__)
+    if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0)
+    {
+        atomic_store_explicit(&g_hpAsymmetric, true, memory_order_relaxed);
+    }
+#endif
+}
+
+/*before the first domain exists, so no reader can run with the other mode*/
+static void hp_fence_init(void)
+{
+    pthread_once(&g_hpFenceOnce, hp_fence_setup);
+}
+
+static inline bool hp_fence_asymmetric(void)
+{
+#if LFQ_ASYMMETRIC_FENCE
+    return atomic_load_explicit(&g_hpAsymmetric, memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+/*
+ * Reader side: after storing a hazard pointer, before re-reading its source.
+ * The store itself stays a release, so that whatever the reader did with the
+ * node it protected before is ordered before Scan() sees the slot change.
+ */
+static inline void hp_publish_fence(void)
+{
+    if (hp_fence_asymmetric())
+    {
+        atomic_signal_fence(memory_order_seq_cst);
+    }
+    else
+    {
+        full_fence();
+    }
+}
+
+/*Scan() side: after unlinking the retired nodes, before reading hazard pointers*/
+static inline void hp_scan_fence(void)
+{
+#if LFQ_ASYMMETRIC_FENCE && defined(__linux__)
+    if (hp_fence_asymmetric())
+    {
+        if (syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) != 0)
+        {
+            /*cannot happen once registered; readers skip their fence, so say so loudly*/
+            LFQueue_error_callback("%s: membarrier() failed\n", __func__);
+        }
+        return;
+    }
+#endif
+    full_fence();
+}
+
+bool LFQueue_asymmetric_fence(void)
+{
+    hp_fence_init();
+    return hp_fence_asymmetric();
+}
+
+static atomic_size_t g_scanCount = ATOMIC_VAR_INIT(0);
+static atomic_ullong g_scanTotalNs = ATOMIC_VAR_INIT(0);
+static atomic_ullong g_scanMaxNs = ATOMIC_VAR_INIT(0);
+
+static inline unsigned long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/*two clock reads and shared RMWs per Scan(), so only with LFQ_SCAN_TIMING*/
+static inline void scan_account(unsigned long long elapsed_ns)
+{
+    atomic_fetch_add_explicit(&g_scanCount, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_scanTotalNs, elapsed_ns, memory_order_relaxed);
+
+    unsigned long long max_ns = atomic_load_explicit(&g_scanMaxNs, memory_order_relaxed);
+    while (elapsed_ns > max_ns &&
+           !atomic_compare_exchange_weak_explicit(&g_scanMaxNs, &max_ns, elapsed_ns,
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+int LFQueue_get_scan_stats(lfq_scan_stats_t *stats)
+{
+    if (!stats)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    stats->scans = atomic_load_explicit(&g_scanCount, memory_order_relaxed);
+    stats->total_ns = atomic_load_explicit(&g_scanTotalNs, memory_order_relaxed);
+    stats->max_ns = atomic_load_explicit(&g_scanMaxNs, memory_order_relaxed);
+    return 0;
+}
+
+void LFQueue_reset_scan_stats(void)
+{
+    atomic_store_explicit(&g_scanCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_scanTotalNs, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_scanMaxNs, 0, memory_order_relaxed);
+}
+
+void Scan(hp_record_t *myhprec)
+{
+#if LFQ_SCAN_TIMING
+    unsigned long long start_ns = monotonic_ns();
+#endif
+    hp_domain_t *domain = myhprec->domain;
+
+    hp_snapshot_t *snap = &g_threadSnapshot;
+    snap->count = 0;
+    if (!hp_snapshot_reserve(snap, atomic_load_explicit(&domain->numOfHPRecord, memory_order_relaxed)))
+    {
+        LFQueue_error_callback("%s: hp_snapshot_reserve() failed\n", __func__);
+        return;
+    }
+
+    hp_scan_fence();
+    struct hp_record_slab *slab = atomic_load_explicit(&domain->slabs, memory_order_acquire);
+    for (; slab != NULL; slab = slab->next)
+    {
+        /*every slot, held or not: a free one only costs two NULL loads on the same lines*/
+        for (hp_record_t *hprec = slab->records; hprec < slab->records + slab->capacity; hprec++)
+        {
+            for (unsigned i = 0; i < K; i++)
+            {
+                node_t *hptr = atomic_load_explicit(&hprec->HP[i], memory_order_acquire);
+                if (hptr == NULL)
+                {
+                    continue;
+                }
+
+                /*records taken after the reserve above; keep every node rather than miss a hazard*/
+                if (snap->count == snap->capacity && !hp_snapshot_reserve(snap, snap->count + 1))
+                {
+                    LFQueue_error_callback("%s: hp_snapshot_reserve() failed\n", __func__);
+                    return;
+                }
+                snap->slots[snap->count++] = hptr;
+            }
+        }
+    }
+
+    hp_snapshot_sort(snap);
+
+    node_t *tmplist = myhprec->rlist;
+    size_t freed = myhprec->rcount;
+    myhprec->rlist = NULL;
+    myhprec->rcount = 0;
+    node_t *node = rlist_pop(&tmplist);
+    while (node != NULL)
+    {
+        if (hp_snapshot_contains(snap, node))
+        {
+            record_push_node(myhprec, node);
+        }
+        else
+        {
+            node_free(node); /*PrepareForReuse*/
+        }
+        node = rlist_pop(&tmplist);
+    }
+    freed -= myhprec->rcount;
+
+    lfq_block_t *block = myhprec->block_rlist;
+    myhprec->block_rlist = NULL;
+    myhprec->block_rcount = 0;
+    while (block != NULL)
+    {
+        lfq_block_t *next = block->retired_next;
+        if (hp_snapshot_contains(snap, (const node_t *)(const void *)block))
+        {
+            record_push_block(myhprec, block);
+        }
+        else
+        {
+            block_reclaim(block);
+        }
+        block = next;
+    }
+
+    LFQ_STAT_INC(myhprec, scans);
+    LFQ_STAT_ADD(myhprec, nodes_freed, freed);
+    LFQ_STAT_ADD(myhprec, nodes_kept, myhprec->rcount);
+    LFQ_STAT_SET(myhprec, retired_backlog, myhprec->rcount);
+
+#if LFQ_SCAN_TIMING
+    scan_account(monotonic_ns() - start_ns);
+#endif
+}
+
+/*Move the retired lists of an inactive record, locked by the caller, to myhprec*/
+static void HPRecord_adopt(hp_record_t *myhprec, hp_record_t *hprec)
+{
+    LFQ_STAT_ADD(myhprec, nodes_adopted, hprec->rcount);
+    while (hprec->rcount > 0)
+    {
+        node_t *node = rlist_pop(&hprec->rlist);
+        hprec->rcount--;
+        record_push_node(myhprec, node);
+        if (myhprec->rcount >= atomic_load_explicit(&myhprec->domain->retireThreshold, memory_order_relaxed))
+        {
+            Scan(myhprec);
+        }
+    }
+
+    /*adopt blocks in one go and let the next Scan() decide*/
+    while (hprec->block_rlist)
+    {
+        lfq_block_t *block = hprec->block_rlist;
+        hprec->block_rlist = block->retired_next;
+        record_push_block(myhprec, block);
+    }
+    hprec->block_rcount = 0;
+
+    LFQ_STAT_SET(hprec, retired_backlog, 0);
+}
+
+void HelpScan(hp_record_t *myhprec)
+{
+    hp_domain_t *domain = myhprec->domain;
+    LFQ_STAT_INC(myhprec, help_scans);
+
+    struct hp_record_slab *slab = atomic_load_explicit(&domain->slabs, memory_order_acquire);
+    for (; slab != NULL; slab = slab->next)
+    {
+        /*only slots handed out before can hold retired nodes*/
+        unsigned long long candidates = atomic_load_explicit(&slab->touched, memory_order_relaxed) &
+                                        ~atomic_load_explicit(&slab->used, memory_order_acquire);
+        while (candidates)
+        {
+            hp_record_t *hprec = &slab->records[__builtin_ctzll(candidates)];
+            candidates &= candidates - 1;
+
+            if (!HPRecord_tryLock(hprec))
+            {
+                /*TAS failed, the lock was already held by another thread.*/
+                continue;
+            }
+
+            HPRecord_adopt(myhprec, hprec);
+            HPRecord_unlock(hprec);
+        }
+    }
+
+    LFQ_STAT_SET(myhprec, retired_backlog, myhprec->rcount);
+}
+
+/*
+ * Background reclaimer, started per domain with hp_domain_start_reclaimer().
+ * A record whose retired list reaches the threshold links it in front of the
+ * reclaimer's inbox with one CAS (the list's tail points at the old inbox) and
+ * carries on; the hand-off that finds an inbox empty wakes the reclaimer. It
+ * takes the inboxes, moves them to its own record and runs Scan() and
+ * HelpScan() there. What is still hazardous stays in its record and is scanned
+ * again after LFQ_RECLAIMER_INTERVAL_US or at the next wake-up; with nothing
+ * kept the reclaimer sleeps until then. Handed-off nodes keep a non-NULL next
+ * like any retired node.
+ */
+struct lfq_reclaimer
+{
+    alignas(CACHE_LINE_SIZE) _Atomic(node_t *) inbox;
+    _Atomic(lfq_block_t *) block_inbox;
+    atomic_ullong oldest_ns;    /*hand-off time of a batch not yet collected, 0: none*/
+    atomic_size_t handoffs;
+    atomic_size_t handed_off;   /*items*/
+    atomic_size_t inline_scans;
+    alignas(CACHE_LINE_SIZE) atomic_size_t collected; /*written by the reclaimer thread only*/
+    atomic_size_t kept;
+    atomic_size_t rounds;
+    atomic_ullong max_lag_ns;
+    atomic_ullong total_lag_ns;
+    hp_domain_t *domain;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+};
+
+/*Hand myhprec's retired lists to the reclaimer; false if there is none or its backlog is full*/
+static bool reclaimer_handoff(hp_record_t *myhprec)
+{
+    struct lfq_reclaimer *r = atomic_load_explicit(&myhprec->domain->reclaimer, memory_order_acquire);
+    if (!r)
+    {
+        return false;
+    }
+
+    /*the reclaimer may collect between the two loads: clamp, or the difference wraps to a huge backlog*/
+    size_t collected = atomic_load_explicit(&r->collected, memory_order_relaxed);
+    size_t handed_off = atomic_load_explicit(&r->handed_off, memory_order_relaxed);
+    if (handed_off > collected && handed_off - collected >= LFQ_RECLAIMER_BACKLOG_MAX)
+    {
+        atomic_fetch_add_explicit(&r->inline_scans, 1, memory_order_relaxed);
+        return false;
+    }
+
+    bool was_empty = false;
+    size_t items = myhprec->rcount + myhprec->block_rcount;
+    if (myhprec->rlist)
+    {
+        node_t *old = atomic_load_explicit(&r->inbox, memory_order_relaxed);
+        do
+        {
+            atomic_store_explicit(&myhprec->rlist_tail->next, old ? old : RLIST_END, memory_order_relaxed);
+        } while (!atomic_compare_exchange_weak_explicit(&r->inbox, &old, myhprec->rlist,
+                                                        memory_order_release, memory_order_relaxed));
+        was_empty = !old;
+        myhprec->rlist = NULL;
+        myhprec->rcount = 0;
+    }
+
+    if (myhprec->block_rlist)
+    {
+        lfq_block_t *old = atomic_load_explicit(&r->block_inbox, memory_order_relaxed);
+        do
+        {
+            myhprec->block_rlist_tail->retired_next = old;
+        } while (!atomic_compare_exchange_weak_explicit(&r->block_inbox, &old, myhprec->block_rlist,
+                                                        memory_order_release, memory_order_relaxed));
+        was_empty = was_empty || !old;
+        myhprec->block_rlist = NULL;
+        myhprec->block_rcount = 0;
+    }
+
+    if (was_empty)
+    {
+        atomic_store_explicit(&r->oldest_ns, monotonic_ns(), memory_order_relaxed);
+        /*the reclaimer checks the inboxes under the lock before it waits, so this wake-up is not lost*/
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    atomic_fetch_add_explicit(&r->handoffs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&r->handed_off, items, memory_order_relaxed);
+    LFQ_STAT_SET(myhprec, retired_backlog, 0);
+    return true;
+}
+
+static void reclaimer_collect(struct lfq_reclaimer *r, hp_record_t *myhprec)
+{
+    /*before the inboxes: a batch that lands in between is collected now and its stamp overestimates the next lag*/
+    unsigned long long oldest = atomic_exchange_explicit(&r->oldest_ns, 0, memory_order_relaxed);
+    node_t *nodes = atomic_exchange_explicit(&r->inbox, NULL, memory_order_acquire);
+    lfq_block_t *blocks = atomic_exchange_explicit(&r->block_inbox, NULL, memory_order_acquire);
+
+    size_t collected = 0;
+    node_t *node;
+    while ((node = rlist_pop(&nodes)) != NULL)
+    {
+        record_push_node(myhprec, node);
+        collected++;
+    }
+    while (blocks)
+    {
+        lfq_block_t *next = blocks->retired_next;
+        record_push_block(myhprec, blocks);
+        blocks = next;
+        collected++;
+    }
+
+    if (collected)
+    {
+        atomic_fetch_add_explicit(&r->collected, collected, memory_order_relaxed);
+        atomic_fetch_add_explicit(&r->rounds, 1, memory_order_relaxed);
+        if (oldest)
+        {
+            unsigned long long lag = monotonic_ns() - oldest;
+            atomic_fetch_add_explicit(&r->total_lag_ns, lag, memory_order_relaxed);
+            if (lag > atomic_load_explicit(&r->max_lag_ns, memory_order_relaxed))
+            {
+                atomic_store_explicit(&r->max_lag_ns, lag, memory_order_relaxed);
+            }
+        }
+    }
+
+    if (myhprec->rcount || myhprec->block_rcount)
+    {
+        Scan(myhprec);
+    }
+    HelpScan(myhprec);
+    atomic_store_explicit(&r->kept, myhprec->rcount + myhprec->block_rcount, memory_order_relaxed);
+}
+
+static bool reclaimer_pending(struct lfq_reclaimer *r)
+{
+    return atomic_load_explicit(&r->inbox, memory_order_relaxed) ||
+           atomic_load_explicit(&r->block_inbox, memory_order_relaxed);
+}
+
+static void *reclaimer_main(void *arg)
+{
+    struct lfq_reclaimer *r = arg;
+    hp_record_t *myhprec = getThreadHPRecord(r->domain);
+    if (!myhprec)
+    {
+        /*hand-offs pile up until LFQ_RECLAIMER_BACKLOG_MAX, then the threads scan inline again*/
+        LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop)
+    {
+        pthread_mutex_unlock(&r->lock);
+        reclaimer_collect(r, myhprec);
+        bool kept = myhprec->rcount || myhprec->block_rcount;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (LFQ_RECLAIMER_INTERVAL_US % 1000000L) * 1000L;
+        deadline.tv_sec += LFQ_RECLAIMER_INTERVAL_US / 1000000L + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_mutex_lock(&r->lock);
+        while (!r->stop && !reclaimer_pending(r))
+        {
+            if (!kept)
+            {
+                pthread_cond_wait(&r->cond, &r->lock);
+            }
+            else if (pthread_cond_timedwait(&r->cond, &r->lock, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    /*nobody retires any more; what is still hazardous goes back with the record*/
+    reclaimer_collect(r, myhprec);
+    LFQueue_cleanup_thread();
+    return NULL;
+}
+
+int hp_domain_start_reclaimer(hp_domain_t *domain)
+{
+    if (!domain)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    pthread_mutex_lock(&domain->reclaimer_lock);
+    if (atomic_load_explicit(&domain->reclaimer, memory_order_relaxed))
+    {
+        pthread_mutex_unlock(&domain->reclaimer_lock);
+        return 0;
+    }
+
+    struct lfq_reclaimer *r = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct lfq_reclaimer));
+    if (!r)
+    {
+        pthread_mutex_unlock(&domain->reclaimer_lock);
+        LFQueue_error_callback("%s: aligned_alloc() failed\n", __func__);
+        return -1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    atomic_init(&r->inbox, NULL);
+    atomic_init(&r->block_inbox, NULL);
+    r->domain = domain;
+    r->stop = false;
+    pthread_mutex_init(&r->lock, NULL);
+    /*a monotonic deadline: stepping the wall clock must not stall the reclaimer*/
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    if (pthread_create(&r->thread, NULL, reclaimer_main, r) != 0)
+    {
+        pthread_mutex_unlock(&domain->reclaimer_lock);
+        LFQueue_error_callback("%s: pthread_create() failed\n", __func__);
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        free(r);
+        return -1;
+    }
+
+    atomic_store_explicit(&domain->reclaimer, r, memory_order_release);
+    pthread_mutex_unlock(&domain->reclaimer_lock);
+    return 0;
+}
+
+/*hp_domain_destroy() only: no thread retires into the domain any more*/
+static void reclaimer_stop(hp_domain_t *domain)
+{
+    struct lfq_reclaimer *r = atomic_exchange_explicit(&domain->reclaimer, NULL, memory_order_acq_rel);
+    if (!r)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = true;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    /*left over only if the reclaimer never got a record*/
+    rlist_delete(atomic_load_explicit(&r->inbox, memory_order_relaxed));
+    block_rlist_delete(atomic_load_explicit(&r->block_inbox, memory_order_relaxed));
+
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+int hp_domain_get_reclaimer_stats(hp_domain_t *domain, lfq_reclaimer_stats_t *stats)
+{
+    if (!domain || !stats)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    struct lfq_reclaimer *r = atomic_load_explicit(&domain->reclaimer, memory_order_acquire);
+    if (!r)
+    {
+        return 0;
+    }
+
+    stats->handoffs = atomic_load_explicit(&r->handoffs, memory_order_relaxed);
+    stats->items_handed_off = atomic_load_explicit(&r->handed_off, memory_order_relaxed);
+    stats->rounds = atomic_load_explicit(&r->rounds, memory_order_relaxed);
+    size_t collected = atomic_load_explicit(&r->collected, memory_order_relaxed);
+    stats->backlog = (stats->items_handed_off > collected ? stats->items_handed_off - collected : 0) +
+                     atomic_load_explicit(&r->kept, memory_order_relaxed);
+    stats->inline_scans = atomic_load_explicit(&r->inline_scans, memory_order_relaxed);
+    stats->max_lag_ns = atomic_load_explicit(&r->max_lag_ns, memory_order_relaxed);
+    stats->total_lag_ns = atomic_load_explicit(&r->total_lag_ns, memory_order_relaxed);
+    return 0;
+}
+
+void retireNode(hp_record_t *myhprec, node_t *node)
+{
+    record_push_node(myhprec, node);
+    LFQ_STAT_SET(myhprec, retired_backlog, myhprec->rcount);
+    if (myhprec->rcount >= atomic_load_explicit(&myhprec->domain->retireThreshold, memory_order_relaxed) &&
+        !reclaimer_handoff(myhprec))
+    {
+        Scan(myhprec);
+        HelpScan(myhprec);
+    }
+}
+
+/*
+ * A block is published in the same hazard pointer slots as nodes, so the same
+ * Scan() frees it. Blocks can be kilobytes (a segment is LFQ_SEGMENT_SIZE
+ * slots), so they get a bound of their own: H + LFQ_BLOCK_RETIRE_SLACK still
+ * frees at least the slack per Scan() without holding 4H of them.
+ */
+static void retireBlock(hp_record_t *myhprec, lfq_block_t *block)
+{
+    record_push_block(myhprec, block);
+    if (myhprec->block_rcount >=
+            atomic_load_explicit(&myhprec->domain->numOfHPRecord, memory_order_relaxed) + LFQ_BLOCK_RETIRE_SLACK &&
+        !reclaimer_handoff(myhprec))
+    {
+        Scan(myhprec);
+        HelpScan(myhprec);
+    }
+}
+
+/*A block no bigger than a node only costs what a node does, so it waits for the node threshold*/
+static void retireSmallBlock(hp_record_t *myhprec, lfq_block_t *block)
+{
+    record_push_block(myhprec, block);
+    if (myhprec->block_rcount >= atomic_load_explicit(&myhprec->domain->retireThreshold, memory_order_relaxed) &&
+        !reclaimer_handoff(myhprec))
+    {
+        Scan(myhprec);
+        HelpScan(myhprec);
+    }
+}
+
+/*Retire count nodes linked through next starting at first, checking the threshold once*/
+static void retireChain(hp_record_t *myhprec, node_t *first, size_t count)
+{
+    node_t *node = first;
+    for (size_t i = 0; i < count; i++)
+    {
+        node_t *next = atomic_load_explicit(&node->next, memory_order_relaxed);
+        record_push_node(myhprec, node);
+        node = next;
+    }
+
+    LFQ_STAT_SET(myhprec, retired_backlog, myhprec->rcount);
+    if (myhprec->rcount >= atomic_load_explicit(&myhprec->domain->retireThreshold, memory_order_relaxed) &&
+        !reclaimer_handoff(myhprec))
+    {
+        Scan(myhprec);
+        HelpScan(myhprec);
+    }
+}
+
+/*
+ * Epoch-based reclamation, selected per queue with LFQ_RECLAIM_EBR. A thread
+ * announces the domain epoch in its record on entry and clears it on exit;
+ * nodes retired while the global epoch was e are freed once it reaches e + 2,
+ * i.e. once every thread that could still see them has left its operation.
+ * The epoch only advances when every active record has announced it.
+ */
+#define EBR_ACTIVE (1u)
+#define EBR_EPOCH_MASK (UINT_MAX >> 1)
+
+static inline void ebr_enter(hp_record_t *myhprec)
+{
+    unsigned e = atomic_load_explicit(&myhprec->domain->epoch, memory_order_relaxed);
+    atomic_store_explicit(&myhprec->epoch, (e << 1) | EBR_ACTIVE, memory_order_relaxed);
+    full_fence();
+}
+
+static inline void ebr_exit(hp_record_t *myhprec)
+{
+    atomic_store_explicit(&myhprec->epoch, 0, memory_order_release);
+}
+
+static bool ebr_try_advance(hp_domain_t *domain, unsigned e)
+{
+    full_fence();
+
+    struct hp_record_slab *slab = atomic_load_explicit(&domain->slabs, memory_order_acquire);
+    for (; slab != NULL; slab = slab->next)
+    {
+        for (hp_record_t *hprec = slab->records; hprec < slab->records + slab->capacity; hprec++)
+        {
+            unsigned announced = atomic_load_explicit(&hprec->epoch, memory_order_acquire);
+            if ((announced & EBR_ACTIVE) && (announced >> 1) != (e & EBR_EPOCH_MASK))
+            {
+                return false;
+            }
+        }
+    }
+
+    return atomic_compare_exchange_strong_explicit(&domain->epoch, &e, e + 1,
+                                                   memory_order_acq_rel, memory_order_relaxed);
+}
+
+static void ebr_free_bucket(hp_record_t *myhprec, unsigned idx)
+{
+    node_t *node = myhprec->limbo[idx];
+    while (node)
+    {
+        node_t *next = rlist_next(node);
+        node_free(node);
+        node = next;
+        myhprec->limbo_count--;
+        LFQ_STAT_INC(myhprec, nodes_freed);
+    }
+    myhprec->limbo[idx] = NULL;
+}
+
+static void ebr_retire_chain(hp_record_t *myhprec, node_t *first, size_t count)
+{
+    hp_domain_t *domain = myhprec->domain;
+    unsigned e = atomic_load_explicit(&domain->epoch, memory_order_acquire);
+    unsigned idx = e % LFQ_EBR_EPOCHS;
+
+    /*a bucket still tagged with an older epoch is at least three epochs old, hence safe*/
+    if (myhprec->limbo[idx] && myhprec->limbo_epoch[idx] != e)
+    {
+        ebr_free_bucket(myhprec, idx);
+    }
+    myhprec->limbo_epoch[idx] = e;
+
+    node_t *node = first;
+    for (size_t i = 0; i < count; i++)
+    {
+        node_t *next = atomic_load_explicit(&node->next, memory_order_relaxed);
+        rlist_push(&myhprec->limbo[idx], node);
+        node = next;
+    }
+    myhprec->limbo_count += count;
+    LFQ_STAT_SET(myhprec, retired_backlog, myhprec->limbo_count);
+
+    if (myhprec->limbo_count < atomic_load_explicit(&domain->retireThreshold, memory_order_relaxed))
+    {
+        return;
+    }
+
+    LFQ_STAT_INC(myhprec, scans);
+    ebr_try_advance(domain, e);
+    unsigned global = atomic_load_explicit(&domain->epoch, memory_order_acquire);
+    for (unsigned i = 0; i < LFQ_EBR_EPOCHS; i++)
+    {
+        if (myhprec->limbo[i] && global - myhprec->limbo_epoch[i] >= 2)
+        {
+            ebr_free_bucket(myhprec, i);
+        }
+    }
+    LFQ_STAT_SET(myhprec, retired_backlog, myhprec->limbo_count);
+}
+
+static inline bool queue_uses_ebr(const struct LFQueue *me)
+{
+    return me->attr.reclaim == LFQ_RECLAIM_EBR;
+}
+
+/*
+ * Publish hazard pointer i and check that *src still holds expected. Under
+ * epochs the announcement made on entry already protects the node.
+ */
+static inline bool hp_protect(const struct LFQueue *me, hp_record_t *myhprec, unsigned i, node_t *node,
+                              _Atomic(node_t*) *src, node_t *expected)
+{
+    if (queue_uses_ebr(me))
+    {
+        return true;
+    }
+
+    atomic_store_explicit(&myhprec->HP[i], node, memory_order_release);
+    hp_publish_fence();
+    if (atomic_load_explicit(src, memory_order_acquire) != expected)
+    {
+        LFQ_STAT_INC(myhprec, protect_retries);
+        return false;
+    }
+    return true;
+}
+
+static inline void queue_retire(const struct LFQueue *me, hp_record_t *myhprec, node_t *first, size_t count)
+{
+    if (queue_uses_ebr(me))
+    {
+        ebr_retire_chain(myhprec, first, count);
+    }
+    else if (count == 1)
+    {
+        retireNode(myhprec, first);
+    }
+    else
+    {
+        retireChain(myhprec, first, count);
+    }
+}
+
+static inline void queue_enter(const struct LFQueue *me, hp_record_t *myhprec)
+{
+    if (queue_uses_ebr(me))
+    {
+        ebr_enter(myhprec);
+    }
+}
+
+static inline void queue_exit(const struct LFQueue *me, hp_record_t *myhprec)
+{
+    if (queue_uses_ebr(me))
+    {
+        ebr_exit(myhprec);
+    }
+}
+
+/*
+ * Bounded ring backend (Dmitry Vyukov's MPMC queue). Every cell carries a
+ * sequence number that tells producers and consumers whose turn it is, so the
+ * ring needs neither hazard pointers nor per-item allocation.
+ */
+typedef struct
+{
+    atomic_size_t sequence;
+    int data;
+#if LFQ_SOJOURN
+    unsigned long long stamp;
+#endif
+} ring_cell_t;
+
+struct lfq_ring
+{
+    alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+    alignas(CACHE_LINE_SIZE) size_t mask;
+    ring_cell_t cells[];
+};
+
+static struct lfq_ring *ring_create(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        if (size > (SIZE_MAX >> 1) / sizeof(ring_cell_t))
+        {
+            return NULL;
+        }
+        size <<= 1;
+    }
+
+    size_t bytes = sizeof(struct lfq_ring) + size * sizeof(ring_cell_t);
+    bytes = (bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    struct lfq_ring *ring = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    if (!ring)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        atomic_init(&ring->cells[i].sequence, i);
+        ring->cells[i].data = 0;
+    }
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    ring->mask = size - 1;
+
+    return ring;
+}
+
+static lfq_err_t ring_enqueue(struct lfq_ring *ring, const int *items, size_t n)
+{
+#if LFQ_SOJOURN
+    unsigned long long now = monotonic_ns();
+#endif
+    /*a batch larger than the ring would never fit, so retrying on LFQ_EFULL would spin forever*/
+    if (n > ring->mask + 1)
+    {
+        LFQueue_error_callback("%s: batch of %zu exceeds the capacity %zu\n", __func__, n, ring->mask + 1);
+        return LFQ_EINVAL;
+    }
+
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    while (1)
+    {
+        /*every cell of the batch has to be free in this lap before the range is claimed*/
+        size_t i = 0;
+        intptr_t dif = 0;
+        for (; i < n; i++)
+        {
+            size_t seq = atomic_load_explicit(&ring->cells[(pos + i) & ring->mask].sequence, memory_order_acquire);
+            dif = (intptr_t)seq - (intptr_t)(pos + i);
+            if (dif != 0)
+            {
+                break;
+            }
+        }
+
+        if (i == n)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + n,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            return LFQ_EFULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        ring_cell_t *cell = &ring->cells[(pos + i) & ring->mask];
+        cell->data = items[i];
+#if LFQ_SOJOURN
+        cell->stamp = now;
+#endif
+        /*seq_cst so that the publish is ordered before the waiters check in wake_waiters()*/
+        atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_seq_cst);
+    }
+
+    return LFQ_OK;
+}
+
+/*sojourn is NULL unless built with LFQ_SOJOURN*/
+static size_t ring_dequeue(struct lfq_ring *ring, int *out, size_t max, struct lfq_sojourn *sojourn)
+{
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    size_t count = 0;
+    while (1)
+    {
+        /*claim the run of published cells starting at pos, up to max*/
+        count = 0;
+        intptr_t dif = 0;
+        while (count < max)
+        {
+            size_t seq = atomic_load_explicit(&ring->cells[(pos + count) & ring->mask].sequence, memory_order_acquire);
+            dif = (intptr_t)seq - (intptr_t)(pos + count + 1);
+            if (dif != 0)
+            {
+                break;
+            }
+            count++;
+        }
+
+        if (count > 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + count,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            return 0;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+#if LFQ_SOJOURN
+    unsigned long long now = sojourn ? monotonic_ns() : 0;
+#else
+    (void)sojourn;
+#endif
+    for (size_t i = 0; i < count; i++)
+    {
+        ring_cell_t *cell = &ring->cells[(pos + i) & ring->mask];
+        out[i] = cell->data;
+#if LFQ_SOJOURN
+        if (sojourn)
+        {
+            sojourn_record(sojourn, cell->stamp, now);
+        }
+#endif
+        atomic_store_explicit(&cell->sequence, pos + i + ring->mask + 1, memory_order_release);
+    }
+
+    return count;
+}
+
+/*the calling thread's histogram for this queue, NULL when not recording*/
+static inline struct lfq_sojourn *queue_sojourn(struct LFQueue *me)
+{
+#if LFQ_SOJOURN
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+    return myhprec ? myhprec->sojourn : NULL;
+#else
+    (void)me;
+    return NULL;
+#endif
+}
+
+/*
+ * Parking for dequeueLF_wait(). Producers only pay for a load of waiters unless
+ * a consumer is actually asleep; wake_seq is the futex word consumers sleep on.
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(atomic_uint *word, unsigned expected, long timeout_ns)
+{
+#ifdef __linux__
+    struct timespec ts;
+    struct timespec *tsp = NULL;
+    if (timeout_ns > 0)
+    {
+        ts.tv_sec = timeout_ns / 1000000000L;
+        ts.tv_nsec = timeout_ns % 1000000000L;
+        tsp = &ts;
+    }
+    syscall(SYS_futex, (unsigned *)word, FUTEX_WAIT_PRIVATE, expected, tsp, NULL, 0);
+#else
+    /*no futex: poll the word with short sleeps*/
+    long slept_ns = 0;
+    const long step_ns = 50000;
+    while (atomic_load_explicit(word, memory_order_acquire) == expected && (timeout_ns < 0 || slept_ns < timeout_ns))
+    {
+        struct timespec ts = {0, step_ns};
+        nanosleep(&ts, NULL);
+        slept_ns += step_ns;
+    }
+#endif
+}
+
+static void futex_wake(atomic_uint *word, size_t count)
+{
+#ifdef __linux__
+    int n = (count > INT_MAX) ? INT_MAX : (int)count;
+    syscall(SYS_futex, (unsigned *)word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#else
+    (void)word;
+    (void)count;
+#endif
+}
+
+/*
+ * Readiness eventfd (attr.eventfd). A consumer that finds the queue empty
+ * drains the fd, arms it and looks once more; the first enqueue after that
+ * disarms it and writes the fd, so there is one write(2) and one read(2) per
+ * empty to non-empty transition however many items follow. Same pairing as
+ * waiters: the consumer's store of fd_armed and its second look against the
+ * producer's seq_cst publish and its seq_cst load of fd_armed.
+ */
+static void fd_notify(struct LFQueue *me)
+{
+    if (!atomic_load_explicit(&me->fd_armed, memory_order_seq_cst) ||
+        !atomic_exchange_explicit(&me->fd_armed, false, memory_order_relaxed))
+    {
+        return;
+    }
+
+#ifdef __linux__
+    uint64_t one = 1;
+    if (write(me->efd, &one, sizeof(one)) != sizeof(one))
+    {
+        LFQueue_error_callback("%s: write() to eventfd failed\n", __func__);
+    }
+#endif
+    atomic_fetch_add_explicit(&me->fd_writes, 1, memory_order_relaxed);
+    /*after the write, so that whoever sees the flag finds the count to drain*/
+    atomic_store_explicit(&me->fd_signaled, true, memory_order_release);
+}
+
+static void fd_rearm(struct LFQueue *me)
+{
+#ifdef __linux__
+    if (atomic_exchange_explicit(&me->fd_signaled, false, memory_order_acquire))
+    {
+        uint64_t count;
+        if (read(me->efd, &count, sizeof(count)) == sizeof(count))
+        {
+            atomic_fetch_add_explicit(&me->fd_reads, 1, memory_order_relaxed);
+        }
+    }
+#endif
+
+    if (!atomic_load_explicit(&me->fd_armed, memory_order_relaxed))
+    {
+        atomic_store_explicit(&me->fd_armed, true, memory_order_seq_cst);
+    }
+    full_fence();
+}
+
+static inline void wake_waiters(struct LFQueue *me, size_t count)
+{
+    if (me->efd >= 0)
+    {
+        fd_notify(me);
+    }
+
+    if (atomic_load_explicit(&me->waiters, memory_order_seq_cst) == 0)
+    {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&me->wake_seq, 1, memory_order_release);
+    futex_wake(&me->wake_seq, count);
+}
+
+/*
+ * Contention backoff between CAS retries on the list backend. The bound doubles
+ * per consecutive failure of one operation; it restarts with every operation.
+ */
+static _Thread_local uint32_t g_threadBackoffSeed = 0;
+
+static inline uint32_t backoff_random(void)
+{
+    uint32_t x = g_threadBackoffSeed;
+    if (x == 0)
+    {
+        x = (uint32_t)(uintptr_t)&g_threadBackoffSeed * 2654435761u | 1u;
+    }
+    /*xorshift32*/
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_threadBackoffSeed = x;
+    return x;
+}
+
+static inline void backoff(const struct LFQueue *me, hp_record_t *myhprec, unsigned *limit)
+{
+    unsigned spins;
+    switch (me->attr.backoff)
+    {
+    case LFQ_BACKOFF_EXP:
+        spins = *limit;
+        break;
+    case LFQ_BACKOFF_RANDOM:
+        spins = 1 + backoff_random() % *limit;
+        break;
+    default:
+        return;
+    }
+
+    for (unsigned i = 0; i < spins; i++)
+    {
+        cpu_relax();
+    }
+    if (*limit < LFQ_BACKOFF_MAX)
+    {
+        *limit <<= 1;
+    }
+    LFQ_STAT_ADD(myhprec, backoff_spins, spins);
+}
+
+/*
+ * Segmented backend (after the FAA array queues of LCRQ/LPRQ, without their
+ * CAS2/ring reuse): an unbounded list of fixed segments. Each segment is
+ * filled and drained by fetch-and-add on its indices; only moving to a new
+ * segment needs a CAS. A consumer that overtakes a producer marks the slot
+ * taken, and the producer simply claims another index.
+ */
+struct lfq_segq
+{
+    alignas(CACHE_LINE_SIZE) _Atomic(lfq_segment_t*) head;
+    alignas(CACHE_LINE_SIZE) _Atomic(lfq_segment_t*) tail;
+};
+
+static lfq_segment_t *segment_create(void)
+{
+    lfq_segment_t *seg = aligned_alloc(CACHE_LINE_SIZE, sizeof(lfq_segment_t));
+    if (!seg)
+    {
+        return NULL;
+    }
+
+    atomic_init(&seg->enq_idx, 0);
+    atomic_init(&seg->deq_idx, 0);
+    atomic_init(&seg->next, NULL);
+    seg->block.retired_next = NULL;
+    seg->block.reclaim = NULL;
+    for (size_t i = 0; i < LFQ_SEGMENT_SIZE; i++)
+    {
+        atomic_init(&seg->slots[i], SEG_EMPTY);
+    }
+    return seg;
+}
+
+static struct lfq_segq *segq_create(void)
+{
+    struct lfq_segq *q = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct lfq_segq));
+    lfq_segment_t *seg = segment_create();
+    if (!q || !seg)
+    {
+        free(q);
+        free(seg);
+        return NULL;
+    }
+
+    atomic_init(&q->head, seg);
+    atomic_init(&q->tail, seg);
+    return q;
+}
+
+static void segq_destroy(struct lfq_segq *q)
+{
+    lfq_segment_t *seg = atomic_load_explicit(&q->head, memory_order_relaxed);
+    while (seg)
+    {
+        lfq_segment_t *next = atomic_load_explicit(&seg->next, memory_order_relaxed);
+        free(seg);
+        seg = next;
+    }
+    free(q);
+}
+
+static inline bool seg_protect(hp_record_t *myhprec, unsigned i, lfq_segment_t *seg,
+                               _Atomic(lfq_segment_t*) *src)
+{
+    atomic_store_explicit(&myhprec->HP[i], (node_t *)(void *)seg, memory_order_release);
+    hp_publish_fence();
+    if (atomic_load_explicit(src, memory_order_acquire) != seg)
+    {
+        LFQ_STAT_INC(myhprec, protect_retries);
+        return false;
+    }
+    return true;
+}
+
+static lfq_err_t segq_enqueue(struct LFQueue *me, hp_record_t *myhprec, int data)
+{
+    struct lfq_segq *q = me->segq;
+    unsigned long long item = SEG_FULL(data);
+#if LFQ_SOJOURN
+    unsigned long long stamp = monotonic_ns();
+#endif
+    unsigned limit = LFQ_BACKOFF_MIN;
+    while (1)
+    {
+        lfq_segment_t *t = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (!seg_protect(myhprec, 0, t, &q->tail))
+        {
+            continue;
+        }
+
+        size_t idx = atomic_fetch_add_explicit(&t->enq_idx, 1, memory_order_relaxed);
+        if (idx < LFQ_SEGMENT_SIZE)
+        {
+#if LFQ_SOJOURN
+            t->stamps[idx] = stamp;
+#endif
+            unsigned long long expected = SEG_EMPTY;
+            /*seq_cst so that the publish is ordered before the waiters check in wake_waiters()*/
+            if (atomic_compare_exchange_strong_explicit(&t->slots[idx], &expected, item,
+                                                        memory_order_seq_cst, memory_order_relaxed))
+            {
+                return LFQ_OK;
+            }
+            LFQ_STAT_INC(myhprec, enqueue_cas_failures);
+            continue;
+        }
+
+        /*segment full: append a new one that already holds the item, or help whoever did*/
+        lfq_segment_t *next = atomic_load_explicit(&t->next, memory_order_acquire);
+        if (next != NULL)
+        {
+            LFQ_STAT_INC(myhprec, tail_helps);
+            atomic_compare_exchange_strong_explicit(&q->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
+            continue;
+        }
+
+        lfq_segment_t *seg = segment_create();
+        if (!seg)
+        {
+            LFQueue_error_callback("%s: segment_create() failed\n", __func__);
+            return LFQ_ENOMEM;
+        }
+        atomic_store_explicit(&seg->slots[0], item, memory_order_relaxed);
+#if LFQ_SOJOURN
+        seg->stamps[0] = stamp;
+#endif
+        atomic_store_explicit(&seg->enq_idx, 1, memory_order_relaxed);
+
+        if (atomic_compare_exchange_strong_explicit(&t->next, &next, seg, memory_order_seq_cst, memory_order_relaxed))
+        {
+            atomic_compare_exchange_strong_explicit(&q->tail, &t, seg, memory_order_acq_rel, memory_order_relaxed);
+            return LFQ_OK;
+        }
+        free(seg);
+        LFQ_STAT_INC(myhprec, enqueue_cas_failures);
+        backoff(me, myhprec, &limit);
+    }
+}
+
+static lfq_err_t segq_dequeue(struct LFQueue *me, hp_record_t *myhprec, int *output)
+{
+    struct lfq_segq *q = me->segq;
+    unsigned limit = LFQ_BACKOFF_MIN;
+    while (1)
+    {
+        lfq_segment_t *h = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (!seg_protect(myhprec, 0, h, &q->head))
+        {
+            continue;
+        }
+
+        /*do not burn slots of an empty queue*/
+        if (atomic_load_explicit(&h->deq_idx, memory_order_relaxed) >=
+                atomic_load_explicit(&h->enq_idx, memory_order_acquire) &&
+            atomic_load_explicit(&h->next, memory_order_acquire) == NULL)
+        {
+            return LFQ_EEMPTY;
+        }
+
+        size_t idx = atomic_fetch_add_explicit(&h->deq_idx, 1, memory_order_relaxed);
+        if (idx < LFQ_SEGMENT_SIZE)
+        {
+            unsigned long long slot = atomic_exchange_explicit(&h->slots[idx], SEG_TAKEN, memory_order_acq_rel);
+            if (slot == SEG_EMPTY)
+            {
+                continue;
+            }
+            *output = SEG_DATA(slot);
+#if LFQ_SOJOURN
+            sojourn_record(myhprec->sojourn, h->stamps[idx], monotonic_ns());
+#endif
+            return LFQ_OK;
+        }
+
+        /*segment drained: move head on and retire it*/
+        lfq_segment_t *next = atomic_load_explicit(&h->next, memory_order_acquire);
+        if (next == NULL)
+        {
+            return LFQ_EEMPTY;
+        }
+
+        /*tail must not be left on a retired segment*/
+        lfq_segment_t *t = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (t == h)
+        {
+            LFQ_STAT_INC(myhprec, tail_helps);
+            atomic_compare_exchange_strong_explicit(&q->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
+        }
+
+        if (atomic_compare_exchange_strong_explicit(&q->head, &h, next, memory_order_acq_rel, memory_order_relaxed))
+        {
+            retireBlock(myhprec, &h->block);
+        }
+        else
+        {
+            LFQ_STAT_INC(myhprec, dequeue_cas_failures);
+            backoff(me, myhprec, &limit);
+        }
+    }
+}
+
+int queue_attr_init(queue_attr_t* attr) {
+    if (!attr) {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+    attr->enqueueCallback = NULL;
+    attr->onEmptyCallback = NULL;
+    attr->backend = LFQ_BACKEND_LIST;
+    attr->capacity = 0;
+    attr->domain = NULL;
+    attr->reclaim = LFQ_RECLAIM_HP;
+    attr->backoff = LFQ_BACKOFF_NONE;
+    attr->background_reclaim = false;
+    attr->track_size = false;
+    attr->max_size = 0;
+    attr->eventfd = false;
+    return 0;
+}
+
+/*
+ * Size tracking. Every thread counts its enqueues and dequeues on the shard of
+ * its ticket, so LFQueue_size_approx() sums LFQ_SIZE_SHARDS lines and never
+ * reads head or tail. A bounded queue (max_size) hands out free slots as
+ * credits: producers take them from the pool in batches into their shard,
+ * consumers give them back to theirs and return full batches to the pool.
+ * Credits only move, so at most max_size items are ever in the queue; only when
+ * the pool runs dry does a producer sweep the credits stranded in other shards
+ * before it reports LFQ_EFULL.
+ */
+struct lfq_size_shard
+{
+    alignas(CACHE_LINE_SIZE) atomic_size_t enqueued;
+    atomic_long credits;  /*free slots taken from the pool by this shard's producers*/
+    alignas(CACHE_LINE_SIZE) atomic_size_t dequeued;
+    atomic_long returned; /*free slots given back by this shard's consumers, not yet in the pool*/
+};
+
+struct lfq_size
+{
+    alignas(CACHE_LINE_SIZE) atomic_long pool; /*free slots no shard holds*/
+    long batch;
+    struct lfq_size_shard shards[LFQ_SIZE_SHARDS];
+};
+
+static atomic_uint g_sizeShardTicket = ATOMIC_VAR_INIT(0);
+static _Thread_local unsigned g_threadSizeShard = UINT_MAX;
+
+static struct lfq_size *size_create(size_t max_size)
+{
+    struct lfq_size *sz = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct lfq_size));
+    if (!sz)
+    {
+        return NULL;
+    }
+
+    memset(sz, 0, sizeof(*sz));
+    atomic_init(&sz->pool, (long)max_size);
+    /*small bounds move credits one by one, or the first shards would hoard them*/
+    sz->batch = (long)(max_size / (4 * LFQ_SIZE_SHARDS));
+    if (sz->batch > LFQ_SIZE_CREDIT_BATCH)
+    {
+        sz->batch = LFQ_SIZE_CREDIT_BATCH;
+    }
+    return sz;
+}
+
+static inline struct lfq_size_shard *size_shard(struct lfq_size *sz)
+{
+    if (g_threadSizeShard == UINT_MAX)
+    {
+        g_threadSizeShard = atomic_fetch_add_explicit(&g_sizeShardTicket, 1, memory_order_relaxed) &
+                            (LFQ_SIZE_SHARDS - 1);
+    }
+    return &sz->shards[g_threadSizeShard];
+}
+
+/*Move every stranded credit back to the pool*/
+static void size_collect(struct lfq_size *sz)
+{
+    long found = 0;
+    for (unsigned i = 0; i < LFQ_SIZE_SHARDS; i++)
+    {
+        found += atomic_exchange_explicit(&sz->shards[i].returned, 0, memory_order_relaxed);
+        found += atomic_exchange_explicit(&sz->shards[i].credits, 0, memory_order_relaxed);
+    }
+    if (found)
+    {
+        atomic_fetch_add_explicit(&sz->pool, found, memory_order_relaxed);
+    }
+}
+
+/*Take n free slots of a bounded queue; false if it is full*/
+static bool size_reserve(struct LFQueue *me, size_t n)
+{
+    struct lfq_size *sz = me->size;
+    if (!sz || me->attr.max_size == 0)
+    {
+        return true;
+    }
+
+    struct lfq_size_shard *shard = size_shard(sz);
+    long need = (long)n;
+    long have = atomic_load_explicit(&shard->credits, memory_order_relaxed);
+    while (have >= need)
+    {
+        if (atomic_compare_exchange_weak_explicit(&shard->credits, &have, have - need, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        long pool = atomic_load_explicit(&sz->pool, memory_order_relaxed);
+        while (pool >= need)
+        {
+            long take = pool < need + sz->batch ? pool : need + sz->batch;
+            if (atomic_compare_exchange_weak_explicit(&sz->pool, &pool, pool - take, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                if (take > need)
+                {
+                    atomic_fetch_add_explicit(&shard->credits, take - need, memory_order_relaxed);
+                }
+                return true;
+            }
+        }
+
+        if (attempt == 0)
+        {
+            size_collect(sz);
+        }
+    }
+
+    return false;
+}
+
+/*done of the reserved items were enqueued; the slots of the others go back*/
+static inline void size_account_enqueue(struct LFQueue *me, size_t reserved, size_t done)
+{
+    struct lfq_size *sz = me->size;
+    if (!sz)
+    {
+        return;
+    }
+
+    struct lfq_size_shard *shard = size_shard(sz);
+    if (done)
+    {
+        atomic_fetch_add_explicit(&shard->enqueued, done, memory_order_relaxed);
+    }
+    if (me->attr.max_size && reserved > done)
+    {
+        atomic_fetch_add_explicit(&shard->credits, (long)(reserved - done), memory_order_relaxed);
+    }
+}
+
+static inline void size_account_dequeue(struct LFQueue *me, size_t done)
+{
+    struct lfq_size *sz = me->size;
+    if (!sz || done == 0)
+    {
+        return;
+    }
+
+    struct lfq_size_shard *shard = size_shard(sz);
+    atomic_fetch_add_explicit(&shard->dequeued, done, memory_order_relaxed);
+    if (me->attr.max_size &&
+        atomic_fetch_add_explicit(&shard->returned, (long)done, memory_order_relaxed) + (long)done >= sz->batch)
+    {
+        long batch = atomic_exchange_explicit(&shard->returned, 0, memory_order_relaxed);
+        if (batch)
+        {
+            atomic_fetch_add_explicit(&sz->pool, batch, memory_order_relaxed);
+        }
+    }
+}
+
+size_t LFQueue_size_approx(struct LFQueue *me)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    if (!me->size)
+    {
+        return 0;
+    }
+
+    /*
+     * Enqueues first: counters only grow, so the later dequeue sums can only be
+     * larger and a bounded queue never reports more than max_size. A dequeue
+     * may be counted before the enqueue of its item, hence the clamp.
+     */
+    size_t enqueued = 0;
+    size_t dequeued = 0;
+    for (unsigned i = 0; i < LFQ_SIZE_SHARDS; i++)
+    {
+        enqueued += atomic_load_explicit(&me->size->shards[i].enqueued, memory_order_acquire);
+    }
+    for (unsigned i = 0; i < LFQ_SIZE_SHARDS; i++)
+    {
+        dequeued += atomic_load_explicit(&me->size->shards[i].dequeued, memory_order_relaxed);
+    }
+
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+/*Use the domain named by the attributes, or create a private one*/
+static int queue_attach_domain(struct LFQueue *me)
+{
+    me->domain = me->attr.domain;
+    if (!me->domain)
+    {
+        me->domain = hp_domain_create();
+        if (!me->domain)
+        {
+            LFQueue_error_callback("%s: hp_domain_create() failed\n", __func__);
+            return -1;
+        }
+        me->owns_domain = true;
+    }
+    return 0;
+}
+
+static void queue_detach_domain(struct LFQueue *me)
+{
+    /*a shared domain outlives its queues; the nodes retired there still return to the pool on Scan()*/
+    if (me->owns_domain)
+    {
+        hp_domain_destroy(me->domain);
+        me->owns_domain = false;
+    }
+    me->domain = NULL;
+}
+
+static int queue_init_storage(struct LFQueue *me);
+
+int LFQueue_init(struct LFQueue* me, queue_attr_t* attr)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    if (!attr) {
+        queue_attr_init(&me->attr);
+    }
+    else {
+        me->attr = *attr;
+    }
+
+    me->ring = NULL;
+    me->segq = NULL;
+    me->size = NULL;
+    me->domain = NULL;
+    me->owns_domain = false;
+    atomic_init(&me->waiters, 0);
+    atomic_init(&me->wake_seq, 0);
+    me->efd = -1;
+    atomic_init(&me->fd_armed, true);
+    atomic_init(&me->fd_signaled, false);
+    atomic_init(&me->fd_writes, 0);
+    atomic_init(&me->fd_reads, 0);
+    atomic_init(&me->head, NULL);
+    atomic_init(&me->tail, NULL);
+
+    if (queue_init_storage(me) != 0)
+    {
+        return -1;
+    }
+
+    if (me->attr.track_size || me->attr.max_size)
+    {
+        me->size = size_create(me->attr.max_size);
+        if (!me->size)
+        {
+            LFQueue_error_callback("%s: size_create() failed\n", __func__);
+            LFQueue_destroy(me);
+            return -1;
+        }
+    }
+
+    if (me->attr.eventfd)
+    {
+#ifdef __linux__
+        me->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (me->efd < 0)
+        {
+            LFQueue_error_callback("%s: eventfd() failed\n", __func__);
+            LFQueue_destroy(me);
+            return -1;
+        }
+#else
+        LFQueue_error_callback("%s: attr.eventfd needs Linux\n", __func__);
+        LFQueue_destroy(me);
+        return -1;
+#endif
+    }
+
+    return 0;
+}
+
+int LFQueue_fd(struct LFQueue *me)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    return me->efd;
+}
+
+/*Ring, segments or the dummy node of the list, plus the domain they need*/
+static int queue_init_storage(struct LFQueue *me)
+{
+    if (me->attr.backend == LFQ_BACKEND_RING)
+    {
+        if (me->attr.capacity == 0)
+        {
+            LFQueue_error_callback("%s: ring backend needs a capacity\n", __func__);
+            return -1;
+        }
+
+        me->ring = ring_create(me->attr.capacity);
+        if (!me->ring)
+        {
+            LFQueue_error_callback("%s: ring_create() failed\n", __func__);
+            return -1;
+        }
+#if LFQ_SOJOURN
+        /*the ring needs no hazard pointers, only the per-thread histograms of a domain*/
+        if (queue_attach_domain(me) != 0)
+        {
+            free(me->ring);
+            me->ring = NULL;
+            return -1;
+        }
+#endif
+        return 0;
+    }
+
+    if (queue_attach_domain(me) != 0)
+    {
+        return -1;
+    }
+
+    /*segments are always reclaimed with hazard pointers*/
+    if (me->attr.backend == LFQ_BACKEND_SEGMENT)
+    {
+        me->attr.reclaim = LFQ_RECLAIM_HP;
+    }
+
+    if (me->attr.background_reclaim && me->attr.reclaim == LFQ_RECLAIM_HP &&
+        hp_domain_start_reclaimer(me->domain) != 0)
+    {
+        LFQueue_error_callback("%s: hp_domain_start_reclaimer() failed\n", __func__);
+        queue_detach_domain(me);
+        return -1;
+    }
+
+    if (me->attr.backend == LFQ_BACKEND_SEGMENT)
+    {
+        me->segq = segq_create();
+        if (!me->segq)
+        {
+            LFQueue_error_callback("%s: segq_create() failed\n", __func__);
+            queue_detach_domain(me);
+            return -1;
+        }
+        return 0;
+    }
+
+    node_t *dummy = node_alloc();
+    if (!dummy)
+    {
+        LFQueue_error_callback("%s: node_alloc() for dummy node failed\n", __func__);
+        queue_detach_domain(me);
+        return -1;
+    }
+
+    atomic_init(&dummy->next, NULL);
+    atomic_init(&me->head, dummy);
+    atomic_init(&me->tail, dummy);
+
+    return 0;
+}
+
+int LFQueue_destroy(struct LFQueue *me)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    if (me->ring)
+    {
+        free(me->ring);
+        me->ring = NULL;
+    }
+    else if (me->segq)
+    {
+        segq_destroy(me->segq);
+        me->segq = NULL;
+    }
+    else
+    {
+        node_t *curr = atomic_load_explicit(&me->head, memory_order_relaxed);
+        node_t *next = NULL;
+        while (curr)
+        {
+            next = atomic_load_explicit(&curr->next, memory_order_relaxed);
+            node_free(curr);
+            curr = next;
+        }
+
+        me->head = me->tail = NULL;
+    }
+
+    free(me->size);
+    me->size = NULL;
+#ifdef __linux__
+    if (me->efd >= 0)
+    {
+        close(me->efd);
+        me->efd = -1;
+    }
+#endif
+    queue_detach_domain(me);
+
+    return 0;
+}
+
+/*Link a privately built chain first..last behind the current tail with one CAS, then swing tail to last*/
+static void enqueue_chain(struct LFQueue *me, hp_record_t *myhprec, node_t *first, node_t *last)
+{
+    node_t *t = NULL;
+    node_t *next = NULL;
+    unsigned limit = LFQ_BACKOFF_MIN;
+    while (1)
+    {
+        t = atomic_load_explicit(&me->tail, memory_order_acquire);
+        if (!hp_protect(me, myhprec, 0, t, &me->tail, t))
+        {
+            continue;
+        }
+        
+        next = atomic_load_explicit(&t->next, memory_order_acquire);
+        if (next != NULL)
+        {
+            LFQ_STAT_INC(myhprec, tail_helps);
+            atomic_compare_exchange_strong_explicit(&me->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
+            continue;
+        }
+
+        node_t *expected = NULL;
+        /*seq_cst so that the link is ordered before the waiters check in wake_waiters()*/
+        if (atomic_compare_exchange_strong_explicit(&t->next, &expected, first, memory_order_seq_cst, memory_order_relaxed))
+        {
+            break;
+        }
+        LFQ_STAT_INC(myhprec, enqueue_cas_failures);
+        backoff(me, myhprec, &limit);
+    }
+
+    /*if this fails, helpers walk the chain one node at a time until tail reaches last*/
+    atomic_compare_exchange_strong_explicit(&me->tail, &t, last, memory_order_acq_rel, memory_order_relaxed);
+}
+
+static lfq_err_t enqueue_one(struct LFQueue *me, int data);
+
+lfq_err_t enqueueLF(struct LFQueue *me, int data)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    if (!size_reserve(me, 1))
+    {
+        return LFQ_EFULL;
+    }
+
+    if (me->attr.enqueueCallback && (me->attr.enqueueCallback(me, data) != 0)) {
+        size_account_enqueue(me, 1, 0);
+        return LFQ_EUSRDEF;
+    }
+
+    lfq_err_t ret = enqueue_one(me, data);
+    size_account_enqueue(me, 1, ret == LFQ_OK);
+    return ret;
+}
+
+static lfq_err_t enqueue_one(struct LFQueue *me, int data)
+{
+    if (me->ring)
+    {
+        lfq_err_t ret = ring_enqueue(me->ring, &data, 1);
+        if (ret == LFQ_OK)
+        {
+            wake_waiters(me, 1);
+        }
+        return ret;
+    }
+
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+    if (!myhprec)
+    {
+        LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
+        return LFQ_ENOMEM;
+    }
+
+    if (me->segq)
+    {
+        lfq_err_t ret = segq_enqueue(me, myhprec, data);
+        if (ret == LFQ_OK)
+        {
+            wake_waiters(me, 1);
+        }
+        return ret;
+    }
+
+    node_t *newNode = node_alloc();
+    if (!newNode)
+    {
+        LFQueue_error_callback("%s: node_alloc() failed\n", __func__);
+        return LFQ_ENOMEM;
+    }
+
+    newNode->data = data;
+#if LFQ_SOJOURN
+    newNode->stamp = monotonic_ns();
+#endif
+    atomic_store_explicit(&newNode->next, NULL, memory_order_relaxed);
+
+    queue_enter(me, myhprec);
+    enqueue_chain(me, myhprec, newNode, newNode);
+    queue_exit(me, myhprec);
+    wake_waiters(me, 1);
+
+    return LFQ_OK;
+}
+
+static lfq_err_t enqueue_many(struct LFQueue *me, const int *items, size_t n, size_t *done);
+
+lfq_err_t enqueueLF_bulk(struct LFQueue *me, const int *items, size_t n)
+{
+    if (!me || (!items && n > 0))
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    if (n == 0)
+    {
+        return LFQ_OK;
+    }
+
+    /*a batch larger than the bound would never fit, so retrying on LFQ_EFULL would spin forever*/
+    if (me->attr.max_size && n > me->attr.max_size)
+    {
+        LFQueue_error_callback("%s: batch of %zu exceeds max_size %zu\n", __func__, n, me->attr.max_size);
+        return LFQ_EINVAL;
+    }
+
+    /*slots first, so that a full queue does not leave the callbacks' side effects behind*/
+    if (!size_reserve(me, n))
+    {
+        return LFQ_EFULL;
+    }
+
+    if (me->attr.enqueueCallback) {
+        for (size_t i = 0; i < n; i++) {
+            if (me->attr.enqueueCallback(me, items[i]) != 0) {
+                size_account_enqueue(me, n, 0);
+                return LFQ_EUSRDEF;
+            }
+        }
+    }
+
+    size_t done = 0;
+    lfq_err_t ret = enqueue_many(me, items, n, &done);
+    size_account_enqueue(me, n, done);
+    return ret;
+}
+
+/*done: items enqueued, all or none except when the segment backend fails midway*/
+static lfq_err_t enqueue_many(struct LFQueue *me, const int *items, size_t n, size_t *done)
+{
+    if (me->ring)
+    {
+        lfq_err_t ret = ring_enqueue(me->ring, items, n);
+        if (ret == LFQ_OK)
+        {
+            *done = n;
+            wake_waiters(me, n);
+        }
+        return ret;
+    }
+
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+    if (!myhprec)
+    {
+        LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
+        return LFQ_ENOMEM;
+    }
+
+    if (me->segq)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            lfq_err_t ret = segq_enqueue(me, myhprec, items[i]);
+            if (ret != LFQ_OK)
+            {
+                *done = i;
+                wake_waiters(me, i);
+                return ret;
+            }
+        }
+        *done = n;
+        wake_waiters(me, n);
+        return LFQ_OK;
+    }
+
+#if LFQ_SOJOURN
+    unsigned long long now = monotonic_ns();
+#endif
+    node_t *first = NULL;
+    node_t *last = NULL;
+    for (size_t i = 0; i < n; i++)
+    {
+        node_t *newNode = node_alloc();
+        if (!newNode)
+        {
+            LFQueue_error_callback("%s: node_alloc() failed\n", __func__);
+            while (first)
+            {
+                node_t *next = atomic_load_explicit(&first->next, memory_order_relaxed);
+                node_free(first);
+                first = next;
+            }
+            return LFQ_ENOMEM;
+        }
+
+        newNode->data = items[i];
+#if LFQ_SOJOURN
+        newNode->stamp = now;
+#endif
+        atomic_store_explicit(&newNode->next, NULL, memory_order_relaxed);
+        if (last)
+        {
+            atomic_store_explicit(&last->next, newNode, memory_order_relaxed);
+        }
+        else
+        {
+            first = newNode;
+        }
+        last = newNode;
+    }
+
+    queue_enter(me, myhprec);
+    enqueue_chain(me, myhprec, first, last);
+    queue_exit(me, myhprec);
+    *done = n;
+    wake_waiters(me, n);
+
+    return LFQ_OK;
+}
+
+static lfq_err_t dequeue_item(struct LFQueue *me, int *output);
+
+static lfq_err_t dequeue_one(struct LFQueue *me, int *output)
+{
+    lfq_err_t ret = dequeue_item(me, output);
+    if (ret == LFQ_EEMPTY && me->efd >= 0)
+    {
+        fd_rearm(me);
+        ret = dequeue_item(me, output);
+    }
+    if (ret == LFQ_OK)
+    {
+        size_account_dequeue(me, 1);
+    }
+    return ret;
+}
+
+static lfq_err_t dequeue_item(struct LFQueue *me, int *output)
+{
+    if (me->ring)
+    {
+        return ring_dequeue(me->ring, output, 1, queue_sojourn(me)) ? LFQ_OK : LFQ_EEMPTY;
+    }
+
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+    if (!myhprec)
+    {
+        LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
+        return LFQ_ENOMEM;
+    }
+
+    if (me->segq)
+    {
+        return segq_dequeue(me, myhprec, output);
+    }
+
+    queue_enter(me, myhprec);
+
+    node_t *h = NULL;
+    node_t *t = NULL;
+    node_t *next = NULL;
+    unsigned limit = LFQ_BACKOFF_MIN;
+    while (1)
+    {
+        h = atomic_load_explicit(&me->head, memory_order_acquire);
+        if (!hp_protect(me, myhprec, 0, h, &me->head, h))
+        {
+            continue;
+        }
+
+        t = atomic_load_explicit(&me->tail, memory_order_acquire);
+        next = atomic_load_explicit(&h->next, memory_order_acquire);
+        if (!hp_protect(me, myhprec, 1, next, &me->head, h))
+        {
+            continue;
+        }
+
+        if (next == NULL)
+        { /*is empty*/
+            queue_exit(me, myhprec);
+            return LFQ_EEMPTY;
+        }
+
+        if (h == t)
+        {
+            LFQ_STAT_INC(myhprec, tail_helps);
+            atomic_compare_exchange_strong_explicit(&me->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_strong_explicit(&me->head, &h, next, memory_order_acq_rel, memory_order_relaxed))
+        {
+            break;
+        }
+        LFQ_STAT_INC(myhprec, dequeue_cas_failures);
+        backoff(me, myhprec, &limit);
+    }
+
+    *output = next->data;
+#if LFQ_SOJOURN
+    sojourn_record(myhprec->sojourn, next->stamp, monotonic_ns());
+#endif
+    queue_retire(me, myhprec, h, 1);
+    queue_exit(me, myhprec);
+
+    return LFQ_OK;
+}
+
+lfq_err_t dequeueLF(struct LFQueue *me, int *output)
+{
+    if (!me || !output)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    lfq_err_t ret = dequeue_one(me, output);
+    if (ret == LFQ_EEMPTY && me->attr.onEmptyCallback) {
+        me->attr.onEmptyCallback(me);
+    }
+
+    return ret;
+}
+
+static _Thread_local unsigned g_threadSpinBudget = LFQ_WAIT_SPIN_MIN;
+
+lfq_err_t dequeueLF_wait(struct LFQueue *me, int *output, int timeout_ms)
+{
+    if (!me || !output)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    /*adaptive spin: grow the budget when spinning pays off, shrink it when we end up parking anyway*/
+    unsigned budget = g_threadSpinBudget;
+    for (unsigned i = 0; i < budget; i++)
+    {
+        lfq_err_t ret = dequeue_one(me, output);
+        if (ret != LFQ_EEMPTY)
+        {
+            if (ret == LFQ_OK && budget < LFQ_WAIT_SPIN_MAX)
+            {
+                g_threadSpinBudget = budget << 1;
+            }
+            return ret;
+        }
+        cpu_relax();
+    }
+
+    if (budget > LFQ_WAIT_SPIN_MIN)
+    {
+        g_threadSpinBudget = budget >> 1;
+    }
+
+    unsigned long long deadline_ns = 0;
+    if (timeout_ms > 0)
+    {
+        deadline_ns = monotonic_ns() + (unsigned long long)timeout_ms * 1000000ULL;
+    }
+
+    while (1)
+    {
+        unsigned seq = atomic_load_explicit(&me->wake_seq, memory_order_acquire);
+
+        /*pairs with the seq_cst publish in enqueue and the seq_cst load of waiters in wake_waiters()*/
+        atomic_fetch_add_explicit(&me->waiters, 1, memory_order_seq_cst);
+        full_fence();
+
+        lfq_err_t ret = dequeue_one(me, output);
+        if (ret != LFQ_EEMPTY)
+        {
+            atomic_fetch_sub_explicit(&me->waiters, 1, memory_order_relaxed);
+            return ret;
+        }
+
+        if (me->attr.onEmptyCallback) {
+            me->attr.onEmptyCallback(me);
+        }
+
+        long wait_ns = -1;
+        if (timeout_ms == 0)
+        {
+            wait_ns = 0;
+        }
+        else if (timeout_ms > 0)
+        {
+            unsigned long long now_ns = monotonic_ns();
+            wait_ns = (now_ns >= deadline_ns) ? 0 : (long)(deadline_ns - now_ns);
+        }
+
+        if (wait_ns != 0)
+        {
+            futex_wait(&me->wake_seq, seq, wait_ns);
+        }
+        atomic_fetch_sub_explicit(&me->waiters, 1, memory_order_relaxed);
+
+        if (wait_ns == 0)
+        {
+            return dequeue_one(me, output);
+        }
+    }
+}
+
+static lfq_err_t dequeue_many(struct LFQueue *me, int *out, size_t max, size_t *got);
+
+lfq_err_t dequeueLF_bulk(struct LFQueue *me, int *out, size_t max, size_t *got)
+{
+    if (!me || !out || !got || max == 0)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    *got = 0;
+    lfq_err_t ret = dequeue_many(me, out, max, got);
+    if (ret == LFQ_EEMPTY && me->efd >= 0)
+    {
+        fd_rearm(me);
+        ret = dequeue_many(me, out, max, got);
+    }
+    if (ret == LFQ_EEMPTY && me->attr.onEmptyCallback) {
+        me->attr.onEmptyCallback(me);
+    }
+    size_account_dequeue(me, *got);
+    return ret;
+}
+
+static lfq_err_t dequeue_many(struct LFQueue *me, int *out, size_t max, size_t *got)
+{
+    if (me->ring)
+    {
+        *got = ring_dequeue(me->ring, out, max, queue_sojourn(me));
+        if (*got == 0)
+        { /*is empty*/
+            return LFQ_EEMPTY;
+        }
+        return LFQ_OK;
+    }
+
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+    if (!myhprec)
+    {
+        LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
+        return LFQ_ENOMEM;
+    }
+
+    if (me->segq)
+    {
+        while (*got < max && segq_dequeue(me, myhprec, &out[*got]) == LFQ_OK)
+        {
+            (*got)++;
+        }
+        if (*got == 0)
+        { /*is empty*/
+            return LFQ_EEMPTY;
+        }
+        return LFQ_OK;
+    }
+
+    queue_enter(me, myhprec);
+
+    node_t *h = NULL;
+    node_t *t = NULL;
+    node_t *last = NULL;
+    size_t count = 0;
+    unsigned limit = LFQ_BACKOFF_MIN;
+    while (1)
+    {
+        h = atomic_load_explicit(&me->head, memory_order_acquire);
+        if (!hp_protect(me, myhprec, 0, h, &me->head, h))
+        {
+            continue;
+        }
+
+        t = atomic_load_explicit(&me->tail, memory_order_acquire);
+
+        /*
+         * Walk ahead of h without passing the tail we saw. HP[1] is moved from node
+         * to node; as long as head is still h, nothing after h can have been retired,
+         * so one rotating hazard pointer is enough to protect the whole walk.
+         */
+        bool stale = false;
+        last = h;
+        count = 0;
+        while (count < max && last != t)
+        {
+            node_t *next = atomic_load_explicit(&last->next, memory_order_acquire);
+            if (next == NULL)
+            {
+                break;
+            }
+
+            if (!hp_protect(me, myhprec, 1, next, &me->head, h))
+            {
+                stale = true;
+                break;
+            }
+
+            last = next;
+            count++;
+        }
+
+        if (stale)
+        {
+            continue;
+        }
+
+        if (count == 0)
+        {
+            node_t *next = atomic_load_explicit(&h->next, memory_order_acquire);
+            if (!hp_protect(me, myhprec, 1, next, &me->head, h))
+            {
+                continue;
+            }
+
+            if (next == NULL)
+            { /*is empty*/
+                queue_exit(me, myhprec);
+                return LFQ_EEMPTY;
+            }
+
+            /*h == t, tail is lagging*/
+            LFQ_STAT_INC(myhprec, tail_helps);
+            atomic_compare_exchange_strong_explicit(&me->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_strong_explicit(&me->head, &h, last, memory_order_acq_rel, memory_order_relaxed))
+        {
+            break;
+        }
+        LFQ_STAT_INC(myhprec, dequeue_cas_failures);
+        backoff(me, myhprec, &limit);
+    }
+
+    /*h..last are ours now: last is covered by HP[1] (or the epoch), the nodes in between are not retired yet*/
+#if LFQ_SOJOURN
+    unsigned long long now = monotonic_ns();
+#endif
+    node_t *node = atomic_load_explicit(&h->next, memory_order_acquire);
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = node->data;
+#if LFQ_SOJOURN
+        sojourn_record(myhprec->sojourn, node->stamp, now);
+#endif
+        node = atomic_load_explicit(&node->next, memory_order_acquire);
+    }
+    *got = count;
+
+    queue_retire(me, myhprec, h, count);
+    queue_exit(me, myhprec);
+
+    return LFQ_OK;
+}
+
+int LFQueue_get_stats(struct LFQueue *me, lfq_stats_t *stats)
+{
+    if (!me || !stats)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    LFQueue_pool_get_stats(&stats->pool);
+    stats->fd_writes = atomic_load_explicit(&me->fd_writes, memory_order_relaxed);
+    stats->fd_reads = atomic_load_explicit(&me->fd_reads, memory_order_relaxed);
+
+#if LFQ_STATS
+    if (!me->domain)
+    {
+        return 0;
+    }
+
+    struct hp_record_slab *slab = atomic_load_explicit(&me->domain->slabs, memory_order_acquire);
+    for (; slab != NULL; slab = slab->next)
+    {
+        /*slots never handed out have nothing to report*/
+        unsigned long long touched = atomic_load_explicit(&slab->touched, memory_order_relaxed);
+        for (; touched; touched &= touched - 1)
+        {
+            hp_record_t *hprec = &slab->records[__builtin_ctzll(touched)];
+            stats->records++;
+            if (HPRecord_isActive(hprec))
+            {
+                stats->active_records++;
+            }
+
+            stats->enqueue_cas_failures += atomic_load_explicit(&hprec->stats.enqueue_cas_failures, memory_order_relaxed);
+            stats->dequeue_cas_failures += atomic_load_explicit(&hprec->stats.dequeue_cas_failures, memory_order_relaxed);
+            stats->protect_retries += atomic_load_explicit(&hprec->stats.protect_retries, memory_order_relaxed);
+            stats->tail_helps += atomic_load_explicit(&hprec->stats.tail_helps, memory_order_relaxed);
+            stats->scans += atomic_load_explicit(&hprec->stats.scans, memory_order_relaxed);
+            stats->help_scans += atomic_load_explicit(&hprec->stats.help_scans, memory_order_relaxed);
+            stats->nodes_freed += atomic_load_explicit(&hprec->stats.nodes_freed, memory_order_relaxed);
+            stats->nodes_kept += atomic_load_explicit(&hprec->stats.nodes_kept, memory_order_relaxed);
+            stats->nodes_adopted += atomic_load_explicit(&hprec->stats.nodes_adopted, memory_order_relaxed);
+            stats->retired_backlog += atomic_load_explicit(&hprec->stats.retired_backlog, memory_order_relaxed);
+            stats->backoff_spins += atomic_load_explicit(&hprec->stats.backoff_spins, memory_order_relaxed);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+int LFQueue_get_sojourn(struct LFQueue *me, lfq_histogram_t *hist)
+{
+    if (!me || !hist)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    memset(hist, 0, sizeof(*hist));
+
+#if LFQ_SOJOURN
+    if (!me->domain)
+    {
+        return 0;
+    }
+
+    struct hp_record_slab *slab = atomic_load_explicit(&me->domain->slabs, memory_order_acquire);
+    for (; slab != NULL; slab = slab->next)
+    {
+        /*slots never handed out have nothing to report*/
+        unsigned long long touched = atomic_load_explicit(&slab->touched, memory_order_relaxed);
+        for (; touched; touched &= touched - 1)
+        {
+            hp_record_t *hprec = &slab->records[__builtin_ctzll(touched)];
+            struct lfq_sojourn *src = hprec->sojourn;
+            lfq_histogram_t part;
+            part.count = atomic_load_explicit(&src->count, memory_order_relaxed);
+            part.min_ns = atomic_load_explicit(&src->min_ns, memory_order_relaxed);
+            part.max_ns = atomic_load_explicit(&src->max_ns, memory_order_relaxed);
+            part.total_ns = atomic_load_explicit(&src->total_ns, memory_order_relaxed);
+            for (unsigned i = 0; i < LFQ_HIST_BUCKETS; i++)
+            {
+                part.buckets[i] = atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+            }
+            LFQueue_histogram_merge(hist, &part);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Sharded front-end. Threads get a home lane from a global ticket, handed out
+ * round robin on first use, so that producers and consumers spread evenly.
+ */
+static atomic_uint g_laneTicket = ATOMIC_VAR_INIT(0);
+static _Thread_local unsigned g_threadLaneTicket = UINT_MAX;
+
+/*in the consumer's own record, like the other counters: no shared line per lane*/
+#define LFQ_LANE_STAT_INC(hprec, field) \
+    do \
+    { \
+        if (hprec) \
+        { \
+            LFQ_STAT_INC(hprec, field); \
+        } \
+    } while (0)
+
+void LFShardedQueue_set_home(unsigned ticket)
+{
+    g_threadLaneTicket = ticket % (UINT_MAX - 1);
+}
+
+unsigned LFShardedQueue_home_lane(struct LFShardedQueue *me)
+{
+    if (!me || me->num_lanes == 0)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    if (g_threadLaneTicket == UINT_MAX)
+    {
+        g_threadLaneTicket = atomic_fetch_add_explicit(&g_laneTicket, 1, memory_order_relaxed) % (UINT_MAX - 1);
+    }
+    return g_threadLaneTicket % me->num_lanes;
+}
+
+int LFShardedQueue_init(struct LFShardedQueue *me, unsigned lanes, queue_attr_t *attr)
+{
+    if (!me || lanes == 0)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    queue_attr_t lane_attr;
+    if (attr)
+    {
+        lane_attr = *attr;
+    }
+    else
+    {
+        queue_attr_init(&lane_attr);
+    }
+
+    me->num_lanes = 0;
+    me->owns_domain = false;
+    me->domain = lane_attr.domain;
+    if (!me->domain)
+    {
+        /*one domain for all lanes: a thread needs one record, and one Scan() covers every lane*/
+        me->domain = hp_domain_create();
+        if (!me->domain)
+        {
+            LFQueue_error_callback("%s: hp_domain_create() failed\n", __func__);
+            return -1;
+        }
+        me->owns_domain = true;
+    }
+    lane_attr.domain = me->domain;
+
+    me->lanes = aligned_alloc(CACHE_LINE_SIZE, lanes * sizeof(struct LFQueue));
+    if (!me->lanes)
+    {
+        LFQueue_error_callback("%s: aligned_alloc() failed\n", __func__);
+        LFShardedQueue_destroy(me);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < lanes; i++)
+    {
+        if (LFQueue_init(&me->lanes[i], &lane_attr) != 0)
+        {
+            LFQueue_error_callback("%s: LFQueue_init() failed for lane %u\n", __func__, i);
+            LFShardedQueue_destroy(me);
+            return -1;
+        }
+        me->num_lanes++;
+    }
+
+    return 0;
+}
+
+int LFShardedQueue_destroy(struct LFShardedQueue *me)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < me->num_lanes; i++)
+    {
+        LFQueue_destroy(&me->lanes[i]);
+    }
+    free(me->lanes);
+    me->lanes = NULL;
+    me->num_lanes = 0;
+
+    if (me->owns_domain)
+    {
+        hp_domain_destroy(me->domain);
+        me->owns_domain = false;
+    }
+    me->domain = NULL;
+
+    return 0;
+}
+
+lfq_err_t enqueueLF_sharded(struct LFShardedQueue *me, int data)
+{
+    if (!me || me->num_lanes == 0)
     {
         LFQueue_error_callback("%s: invalid input\n", __func__);
         return LFQ_EINVAL;
     }
 
-    if (me->attr.enqueueCallback && (me->attr.enqueueCallback(me, data) != 0)) {
-        return LFQ_EUSRDEF;
+    return enqueueLF(&me->lanes[LFShardedQueue_home_lane(me)], data);
+}
+
+lfq_err_t enqueueLF_sharded_key(struct LFShardedQueue *me, unsigned key, int data)
+{
+    if (!me || me->num_lanes == 0)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
     }
 
-    hp_record_t *myhprec = getThreadHPRecord();
-    if (!myhprec)
+    /*Fibonacci hashing so that sequential keys do not all land on neighbouring lanes in step*/
+    unsigned lane = (unsigned)(((unsigned long long)(key * 2654435769u) * me->num_lanes) >> 32);
+    return enqueueLF(&me->lanes[lane], data);
+}
+
+lfq_err_t dequeueLF_sharded(struct LFShardedQueue *me, int *output)
+{
+    if (!me || !output || me->num_lanes == 0)
     {
-        LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
-        return LFQ_ENOMEM;
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
     }
 
-    node_t *newNode = malloc(sizeof(struct node));
-    if (!newNode)
+    unsigned home = LFShardedQueue_home_lane(me);
+#if LFQ_STATS
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+#else
+    hp_record_t *myhprec = NULL;
+#endif
+
+    lfq_err_t ret = dequeue_one(&me->lanes[home], output);
+    if (ret != LFQ_EEMPTY)
     {
-        LFQueue_error_callback("%s: malloc() failed\n", __func__);
-        return LFQ_ENOMEM;
+        if (ret == LFQ_OK)
+        {
+            LFQ_LANE_STAT_INC(myhprec, lane_home_dequeues);
+        }
+        return ret;
     }
 
-    newNode->data = data;
-    atomic_store_explicit(&newNode->next, NULL, memory_order_relaxed);
+    /*start the sweep at a random victim so that thieves do not pile onto the same lane*/
+    unsigned n = me->num_lanes;
+    unsigned start = n > 1 ? backoff_random() % (n - 1) : 0;
+    for (unsigned i = 0; i + 1 < n; i++)
+    {
+        unsigned victim = (home + 1 + (start + i) % (n - 1)) % n;
+        ret = dequeue_one(&me->lanes[victim], output);
+        if (ret != LFQ_EEMPTY)
+        {
+            if (ret == LFQ_OK)
+            {
+                LFQ_LANE_STAT_INC(myhprec, lane_steals);
+            }
+            return ret;
+        }
+    }
 
-    node_t *t = NULL;
-    node_t *next = NULL;
-    while (1)
+    LFQ_LANE_STAT_INC(myhprec, lane_empty_sweeps);
+    if (me->lanes[home].attr.onEmptyCallback) {
+        me->lanes[home].attr.onEmptyCallback(&me->lanes[home]);
+    }
+    return LFQ_EEMPTY;
+}
+
+int LFShardedQueue_get_stats(struct LFShardedQueue *me, lfq_sharded_stats_t *stats)
+{
+    if (!me || !stats)
     {
-        t = atomic_load_explicit(&me->tail, memory_order_acquire);
-        atomic_store_explicit(&myhprec->HP[0], t, memory_order_release);
-        if (atomic_load_explicit(&me->tail, memory_order_acquire) != t)
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+#if LFQ_STATS
+    if (!me->domain)
+    {
+        return 0;
+    }
+
+    struct hp_record_slab *slab = atomic_load_explicit(&me->domain->slabs, memory_order_acquire);
+    for (; slab != NULL; slab = slab->next)
+    {
+        unsigned long long touched = atomic_load_explicit(&slab->touched, memory_order_relaxed);
+        for (; touched; touched &= touched - 1)
         {
-            continue;
+            hp_record_t *hprec = &slab->records[__builtin_ctzll(touched)];
+            stats->home_dequeues += atomic_load_explicit(&hprec->stats.lane_home_dequeues, memory_order_relaxed);
+            stats->steals += atomic_load_explicit(&hprec->stats.lane_steals, memory_order_relaxed);
+            stats->empty_sweeps += atomic_load_explicit(&hprec->stats.lane_empty_sweeps, memory_order_relaxed);
         }
-        
-        next = atomic_load_explicit(&t->next, memory_order_acquire);
-        if (next != NULL)
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Work-stealing deque. The buffer starts with the block header so that thieves
+ * publish it in a hazard pointer slot and Scan() frees it like a segment.
+ * Slots are atomics only so that a thief reading a slot the owner is
+ * rewriting is not a data race; a stale read is discarded by the top CAS.
+ */
+struct lfq_wsbuf
+{
+    lfq_block_t block;
+    size_t mask;
+    atomic_int items[];
+};
+
+static struct lfq_wsbuf *wsbuf_create(size_t capacity)
+{
+    struct lfq_wsbuf *buf = malloc(sizeof(struct lfq_wsbuf) + capacity * sizeof(atomic_int));
+    if (!buf)
+    {
+        return NULL;
+    }
+
+    buf->block.retired_next = NULL;
+    buf->block.reclaim = NULL;
+    buf->mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&buf->items[i], 0);
+    }
+    return buf;
+}
+
+int LFDeque_init(struct LFDeque *me, size_t capacity, hp_domain_t *domain)
+{
+    if (!me || capacity == 0 || capacity > (SIZE_MAX >> 1) / sizeof(atomic_int))
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    me->domain = domain;
+    me->owns_domain = false;
+    if (!me->domain)
+    {
+        me->domain = hp_domain_create();
+        if (!me->domain)
         {
-            atomic_compare_exchange_strong_explicit(&me->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
-            continue;
+            LFQueue_error_callback("%s: hp_domain_create() failed\n", __func__);
+            return -1;
         }
+        me->owns_domain = true;
+    }
 
-        node_t *expected = NULL;
-        if (atomic_compare_exchange_strong_explicit(&t->next, &expected, newNode, memory_order_acq_rel, memory_order_relaxed))
+    struct lfq_wsbuf *buf = wsbuf_create(size);
+    if (!buf)
+    {
+        LFQueue_error_callback("%s: wsbuf_create() failed\n", __func__);
+        if (me->owns_domain)
         {
-            break;
+            hp_domain_destroy(me->domain);
+            me->owns_domain = false;
+        }
+        me->domain = NULL;
+        return -1;
+    }
+
+    atomic_init(&me->top, 0);
+    atomic_init(&me->bottom, 0);
+    atomic_init(&me->buffer, buf);
+    return 0;
+}
+
+int LFDeque_destroy(struct LFDeque *me)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    /*buffers retired by growing are still in the records and go with the domain or its next Scan()*/
+    free(atomic_load_explicit(&me->buffer, memory_order_relaxed));
+    atomic_store_explicit(&me->buffer, NULL, memory_order_relaxed);
+    if (me->owns_domain)
+    {
+        hp_domain_destroy(me->domain);
+        me->owns_domain = false;
+    }
+    me->domain = NULL;
+    return 0;
+}
+
+/*Owner only: copy the live range into a buffer twice as large and retire the old one*/
+static struct lfq_wsbuf *deque_grow(struct LFDeque *me, struct lfq_wsbuf *old, long long top, long long bottom)
+{
+    size_t size = (old->mask + 1) << 1;
+    if (size > (SIZE_MAX >> 1) / sizeof(atomic_int))
+    {
+        return NULL;
+    }
+
+    struct lfq_wsbuf *buf = wsbuf_create(size);
+    if (!buf)
+    {
+        return NULL;
+    }
+
+    for (long long i = top; i < bottom; i++)
+    {
+        int item = atomic_load_explicit(&old->items[(size_t)i & old->mask], memory_order_relaxed);
+        atomic_store_explicit(&buf->items[(size_t)i & buf->mask], item, memory_order_relaxed);
+    }
+    /*thieves still reading the old buffer find the same items at the same indices*/
+    atomic_store_explicit(&me->buffer, buf, memory_order_release);
+
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
+    if (myhprec)
+    {
+        retireBlock(myhprec, &old->block);
+    }
+    else
+    {
+        /*without a record the old buffer cannot be reclaimed safely, leak it rather than risk a thief*/
+        LFQueue_error_callback("%s: getThreadHPRecord() failed, old buffer leaked\n", __func__);
+    }
+    return buf;
+}
+
+lfq_err_t LFDeque_push(struct LFDeque *me, int data)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    long long b = atomic_load_explicit(&me->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&me->top, memory_order_acquire);
+    struct lfq_wsbuf *buf = atomic_load_explicit(&me->buffer, memory_order_relaxed);
+    if ((size_t)(b - t) > buf->mask)
+    {
+        buf = deque_grow(me, buf, t, b);
+        if (!buf)
+        {
+            return LFQ_ENOMEM;
         }
     }
 
-    atomic_compare_exchange_strong_explicit(&me->tail, &t, newNode, memory_order_acq_rel, memory_order_relaxed);
+    atomic_store_explicit(&buf->items[(size_t)b & buf->mask], data, memory_order_relaxed);
+    /*a release store rather than the paper's release fence, which ThreadSanitizer does not model*/
+    atomic_store_explicit(&me->bottom, b + 1, memory_order_release);
+    return LFQ_OK;
+}
+
+lfq_err_t LFDeque_pop(struct LFDeque *me, int *output)
+{
+    if (!me || !output)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    long long b = atomic_load_explicit(&me->bottom, memory_order_relaxed) - 1;
+    struct lfq_wsbuf *buf = atomic_load_explicit(&me->buffer, memory_order_relaxed);
+    atomic_store_explicit(&me->bottom, b, memory_order_relaxed);
+    /*the claim on bottom must be visible before top is read, or a thief and the owner both take the last item*/
+    full_fence();
+    long long t = atomic_load_explicit(&me->top, memory_order_relaxed);
+
+    if (t > b)
+    {
+        atomic_store_explicit(&me->bottom, b + 1, memory_order_relaxed);
+        return LFQ_EEMPTY;
+    }
+
+    int item = atomic_load_explicit(&buf->items[(size_t)b & buf->mask], memory_order_relaxed);
+    if (t == b)
+    {
+        /*last item: race the thieves for it on top*/
+        bool won = atomic_compare_exchange_strong_explicit(&me->top, &t, t + 1,
+                                                           memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&me->bottom, b + 1, memory_order_relaxed);
+        if (!won)
+        {
+            return LFQ_EEMPTY;
+        }
+    }
 
+    *output = item;
     return LFQ_OK;
 }
 
-lfq_err_t dequeueLF(struct LFQueue *me, int *output)
+lfq_err_t LFDeque_steal(struct LFDeque *me, int *output)
 {
     if (!me || !output)
     {
@@ -568,55 +4239,113 @@ lfq_err_t dequeueLF(struct LFQueue *me, int *output)
         return LFQ_EINVAL;
     }
 
-    hp_record_t *myhprec = getThreadHPRecord();
+    hp_record_t *myhprec = getThreadHPRecord(me->domain);
     if (!myhprec)
     {
         LFQueue_error_callback("%s: getThreadHPRecord() failed\n", __func__);
         return LFQ_ENOMEM;
     }
 
-    node_t *h = NULL;
-    node_t *t = NULL;
-    node_t *next = NULL;
+    lfq_err_t ret = LFQ_EEMPTY;
     while (1)
     {
-        h = atomic_load_explicit(&me->head, memory_order_acquire);
-        atomic_store_explicit(&myhprec->HP[0], h, memory_order_release);
-        if (atomic_load_explicit(&me->head, memory_order_acquire) != h)
-        {
-            continue;
-        }
-
-        t = atomic_load_explicit(&me->tail, memory_order_acquire);
-        next = atomic_load_explicit(&h->next, memory_order_acquire);
-        atomic_store_explicit(&myhprec->HP[1], next, memory_order_release);
-        if (atomic_load_explicit(&me->head, memory_order_acquire) != h)
+        long long t = atomic_load_explicit(&me->top, memory_order_acquire);
+        full_fence();
+        long long b = atomic_load_explicit(&me->bottom, memory_order_acquire);
+        if (t >= b)
         {
-            continue;
-        }
-
-        if (next == NULL)
-        { /*is empty*/
-            if (me->attr.onEmptyCallback) {
-                me->attr.onEmptyCallback(me);
-            }
-            return LFQ_EEMPTY;
+            break;
         }
 
-        if (h == t)
+        struct lfq_wsbuf *buf = atomic_load_explicit(&me->buffer, memory_order_acquire);
+        atomic_store_explicit(&myhprec->HP[0], (node_t *)(void *)buf, memory_order_release);
+        hp_publish_fence();
+        if (atomic_load_explicit(&me->buffer, memory_order_acquire) != buf)
         {
-            atomic_compare_exchange_strong_explicit(&me->tail, &t, next, memory_order_acq_rel, memory_order_relaxed);
+            LFQ_STAT_INC(myhprec, protect_retries);
             continue;
         }
 
-        if (atomic_compare_exchange_strong_explicit(&me->head, &h, next, memory_order_acq_rel, memory_order_relaxed))
+        int item = atomic_load_explicit(&buf->items[(size_t)t & buf->mask], memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&me->top, &t, t + 1,
+                                                    memory_order_seq_cst, memory_order_relaxed))
         {
+            *output = item;
+            ret = LFQ_OK;
             break;
         }
+        /*lost to the owner or another thief, the item at the new top is another one*/
+        LFQ_STAT_INC(myhprec, dequeue_cas_failures);
     }
 
-    *output = next->data;
-    retireNode(myhprec, h);
+    atomic_store_explicit(&myhprec->HP[0], NULL, memory_order_release);
+    return ret;
+}
 
-    return LFQ_OK;
+size_t LFDeque_size_approx(struct LFDeque *me)
+{
+    if (!me)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    long long b = atomic_load_explicit(&me->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&me->top, memory_order_relaxed);
+    return b > t ? (size_t)(b - t) : 0;
+}
+
+hp_record_t *hp_domain_thread_record(hp_domain_t *domain)
+{
+    if (!domain)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return NULL;
+    }
+
+    return getThreadHPRecord(domain);
+}
+
+unsigned long long hp_domain_id(hp_domain_t *domain)
+{
+    if (!domain)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    return domain->id;
+}
+
+void *hp_record_slots(hp_record_t *record)
+{
+    if (!record)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return NULL;
+    }
+
+    return (void *)record->HP;
+}
+
+void hp_retire_block(hp_record_t *record, lfq_block_t *block)
+{
+    if (!record || !block)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return;
+    }
+
+    retireBlock(record, block);
+}
+
+void hp_retire_small_block(hp_record_t *record, lfq_block_t *block)
+{
+    if (!record || !block)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return;
+    }
+
+    retireSmallBlock(record, block);
 }
@@ -4,56 +4,351 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <stdalign.h>
+#include <stddef.h>
+#include "LFHazard.h"
 
 #define CACHE_LINE_SIZE (64)
 
+#ifndef LFQ_NODE_POOL
+#define LFQ_NODE_POOL (1) /*recycle nodes through a per-thread pool instead of malloc()/free()*/
+#endif
+#define LFQ_POOL_DEFAULT_CACHE_SIZE (256) /*max free nodes kept per thread and size class*/
+#define LFQ_POOL_SLAB_NODES (256) /*nodes (or objects of a size class) carved from one slab on refill*/
+
+#ifndef LFQ_NODE_PADDED
+#define LFQ_NODE_PADDED (0) /*one node per cache line: no false sharing between neighbours, 4x the memory*/
+#endif
+
+#ifndef LFQ_STATS
+#define LFQ_STATS (1) /*per-thread operation counters, see LFQueue_get_stats()*/
+#endif
+
+#ifndef LFQ_SCAN_TIMING
+#define LFQ_SCAN_TIMING (0) /*time every Scan() into process-wide counters, see LFQueue_get_scan_stats(); bench enables it*/
+#endif
+
+#ifndef LFQ_SOJOURN
+#define LFQ_SOJOURN (0) /*stamp items on enqueue and record enqueue-to-dequeue time, see LFQueue_get_sojourn()*/
+#endif
+#define LFQ_HIST_SUB_BITS (4) /*log-linear histogram: 16 sub-buckets per power of two, ~6% resolution*/
+#define LFQ_HIST_BUCKETS ((64 - LFQ_HIST_SUB_BITS + 1) << LFQ_HIST_SUB_BITS)
+
+#ifndef LFQ_SEGMENT_SIZE
+#define LFQ_SEGMENT_SIZE (1024) /*slots per segment of LFQ_BACKEND_SEGMENT*/
+#endif
+#define LFQ_BLOCK_RETIRE_SLACK (8) /*retired blocks (segments, deque buffers) a thread keeps beyond H before it scans*/
+
+#ifndef LFQ_ASYMMETRIC_FENCE
+#define LFQ_ASYMMETRIC_FENCE (0) /*Linux: hazard pointer readers skip the store-load fence, Scan() runs membarrier(2)*/
+#endif
+
+#ifndef LFQ_RECLAIMER_INTERVAL_US
+#define LFQ_RECLAIMER_INTERVAL_US (10000) /*until the background reclaimer scans items still hazardous again*/
+#endif
+#define LFQ_RECLAIMER_BACKLOG_MAX (1u << 20) /*uncollected items beyond which retiring threads scan inline again*/
+
+#define LFQ_SIZE_SHARDS (16) /*per-queue counter shards for LFQueue_size_approx(), a power of two*/
+#define LFQ_SIZE_CREDIT_BATCH (64) /*free slots of a bounded queue a shard takes from the pool at once, at most*/
+
+#define LFQ_BACKOFF_MIN (4)    /*pause iterations after the first failed CAS*/
+#define LFQ_BACKOFF_MAX (1024) /*bound of the doubling*/
+
+#define LFQ_WAIT_SPIN_MIN (16)   /*dequeueLF_wait() spin attempts before parking, adapted per thread*/
+#define LFQ_WAIT_SPIN_MAX (4096)
+
 typedef enum {
     LFQ_OK,
     LFQ_ENOMEM,
     LFQ_EINVAL,
     LFQ_EUSRDEF,
     LFQ_EEMPTY,
+    LFQ_EFULL,
 }lfq_err_t;
 
+typedef enum {
+    LFQ_BACKEND_LIST, /*unbounded Michael-Scott list with hazard pointers*/
+    LFQ_BACKEND_RING, /*bounded power-of-two array, capacity is rounded up*/
+    LFQ_BACKEND_SEGMENT, /*unbounded list of fetch-and-add indexed segments, reclaimed with hazard pointers*/
+}lfq_backend_t;
+
+typedef enum {
+    LFQ_RECLAIM_HP,  /*hazard pointers: bounded garbage, two publish-and-revalidate steps per dequeue*/
+    LFQ_RECLAIM_EBR, /*epochs: one announcement per operation, garbage freed in batches*/
+}lfq_reclaim_t;
+
+typedef enum {
+    LFQ_BACKOFF_NONE,   /*retry a failed CAS immediately*/
+    LFQ_BACKOFF_EXP,    /*pause, doubling per consecutive failure up to LFQ_BACKOFF_MAX*/
+    LFQ_BACKOFF_RANDOM, /*pause a random count below the same doubling bound*/
+}lfq_backoff_t;
+
 typedef struct node node_t;
 struct node {
     int data;
-    _Atomic(node_t*) next;
-    struct node* retired_next;
-};
+    _Atomic(node_t*) next; /*once the node has left the queue, links it on a retired list*/
+#if LFQ_SOJOURN
+    unsigned long long stamp; /*enqueue time, CLOCK_MONOTONIC ns*/
+#endif
+}
+#if LFQ_NODE_PADDED
+__attribute__ ((aligned (CACHE_LINE_SIZE)))
+#endif
+;
+
+#define K (LFQ_HP_SLOTS) /*num of hazard pointers per-thread*/
+#ifndef LFQ_HP_MAX_RECORDS
+#define LFQ_HP_MAX_RECORDS (4096) /*records per domain, i.e. threads using it at once; freed records are reused*/
+#endif
+
+#define LFQ_EBR_EPOCHS (3) /*limbo lists per record for epoch-based reclamation*/
 
-#define K (2) /*num of hazard pointers per-thread*/
-typedef struct HPRecord hp_record_t; /*per-thread*/
+struct lfq_sojourn;
+
+/*Counters owned by one record; on their own cache line so that aggregation does not disturb the owner*/
+typedef struct {
+    atomic_size_t enqueue_cas_failures; /*lost CAS on t->next*/
+    atomic_size_t dequeue_cas_failures; /*lost CAS on head*/
+    atomic_size_t protect_retries;      /*hazard pointer published but source moved on*/
+    atomic_size_t tail_helps;           /*swings of a lagging tail*/
+    atomic_size_t scans;                /*Scan() calls, or epoch advance attempts under EBR*/
+    atomic_size_t help_scans;
+    atomic_size_t nodes_freed;
+    atomic_size_t nodes_kept;           /*still hazardous after a Scan()*/
+    atomic_size_t nodes_adopted;        /*taken over from inactive records by HelpScan()*/
+    atomic_size_t retired_backlog;      /*current rcount (limbo_count under EBR)*/
+    atomic_size_t backoff_spins;        /*pause iterations spent backing off after failed CASes*/
+    atomic_size_t lane_home_dequeues;   /*LFShardedQueue, see lfq_sharded_stats_t*/
+    atomic_size_t lane_steals;
+    atomic_size_t lane_empty_sweeps;
+}__attribute__ ((aligned (CACHE_LINE_SIZE))) hp_record_stats_t;
+struct hp_record_slab;
 struct HPRecord {
-    atomic_bool active;
     node_t* rlist; /*retired list*/
+    node_t* rlist_tail; /*valid while rlist is not empty, for handing the list off whole*/
     unsigned rcount; /*retired count*/
+    lfq_block_t* block_rlist; /*retired segments, deque buffers and foreign nodes, freed whole*/
+    lfq_block_t* block_rlist_tail;
+    unsigned block_rcount;
     _Atomic(node_t*) HP[K]; /*hazard pointers*/
-    struct HPRecord* next;
+    atomic_uint epoch; /*announced epoch << 1 | active, LFQ_RECLAIM_EBR only*/
+    node_t* limbo[LFQ_EBR_EPOCHS]; /*nodes retired under epochs, by epoch % 3*/
+    unsigned limbo_epoch[LFQ_EBR_EPOCHS];
+    unsigned limbo_count;
+#if LFQ_STATS
+    hp_record_stats_t stats;
+#endif
+#if LFQ_SOJOURN
+    struct lfq_sojourn* sojourn; /*sojourn times of the items this thread dequeued*/
+#endif
+    hp_domain_t* domain;
+    struct hp_record_slab* slab; /*held while bit slot of slab->used is set*/
+    unsigned slot;
 }__attribute__ ((aligned (CACHE_LINE_SIZE)));
 
 struct LFQueue;
+struct lfq_ring;
+struct lfq_segq;
+struct lfq_size;
 
 typedef struct {
     int (*enqueueCallback)(struct LFQueue* me, int enqueue_data);
     int (*onEmptyCallback)(struct LFQueue* me);
+    lfq_backend_t backend;
+    size_t capacity; /*required by LFQ_BACKEND_RING*/
+    hp_domain_t* domain; /*NULL: the queue creates and owns a private domain*/
+    lfq_reclaim_t reclaim; /*list backend only, segments always use hazard pointers*/
+    lfq_backoff_t backoff; /*list and segment backends*/
+    bool background_reclaim; /*hazard pointers only: start the domain's reclaimer, see hp_domain_start_reclaimer()*/
+    bool track_size; /*count items in per-thread shards for LFQueue_size_approx()*/
+    size_t max_size; /*any backend: enqueue returns LFQ_EFULL beyond this many items, before enqueueCallback runs; 0: unbounded. Implies track_size*/
+    bool eventfd; /*readiness fd for event loops, see LFQueue_fd(); Linux only, LFQueue_init() fails elsewhere*/
 }queue_attr_t;
 
 struct LFQueue {
     alignas(CACHE_LINE_SIZE) _Atomic(node_t*) head;
     alignas(CACHE_LINE_SIZE) _Atomic(node_t*) tail;
     queue_attr_t attr;
+    struct lfq_ring* ring; /*NULL unless LFQ_BACKEND_RING*/
+    struct lfq_segq* segq; /*NULL unless LFQ_BACKEND_SEGMENT*/
+    struct lfq_size* size; /*NULL unless track_size or max_size*/
+    hp_domain_t* domain;
+    bool owns_domain;
+    alignas(CACHE_LINE_SIZE) atomic_uint waiters; /*consumers parked in dequeueLF_wait()*/
+    atomic_uint wake_seq; /*futex word*/
+    int efd; /*-1 unless attr.eventfd*/
+    atomic_bool fd_armed; /*a consumer found the queue empty; the next enqueue writes efd*/
+    atomic_bool fd_signaled; /*efd was written and not drained yet*/
+    atomic_size_t fd_writes;
+    atomic_size_t fd_reads;
 };
 
+typedef struct {
+    size_t hits;   /*allocations served from the thread's cache*/
+    size_t misses; /*allocations that had to refill from the overflow list or a new slab*/
+    size_t slabs;  /*slabs allocated so far*/
+}lfq_pool_stats_t;
+
+typedef struct {
+    size_t scans;                /*Scan() calls*/
+    unsigned long long total_ns; /*time spent in Scan()*/
+    unsigned long long max_ns;   /*slowest single Scan()*/
+}lfq_scan_stats_t;
+
+/*Aggregated over every record of the queue's domain, so a shared domain reports all of its queues*/
+typedef struct {
+    size_t enqueue_cas_failures;
+    size_t dequeue_cas_failures;
+    size_t protect_retries;
+    size_t tail_helps;
+    size_t scans;
+    size_t help_scans;
+    size_t nodes_freed;
+    size_t nodes_kept;
+    size_t nodes_adopted;
+    size_t retired_backlog;
+    size_t backoff_spins;
+    size_t records;
+    size_t active_records;
+    size_t fd_writes; /*eventfd write(2)/read(2) calls of this queue, counted with or without LFQ_STATS*/
+    size_t fd_reads;
+    lfq_pool_stats_t pool;
+}lfq_stats_t;
+
+/*
+ * HDR-style histogram of nanosecond values: exact below 16, then 16 linear
+ * sub-buckets per power of two. Histograms of the same layout merge by adding buckets.
+ */
+typedef struct {
+    size_t count;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+    unsigned long long total_ns;
+    size_t buckets[LFQ_HIST_BUCKETS];
+}lfq_histogram_t;
+
 int queue_attr_init(queue_attr_t* attr);
 
 void LFQueue_set_error_callback(int (*errback)(const char *, ...));
+extern int (*LFQueue_error_callback)(const char *, ...); /*the current callback, for the library's other translation units*/
 
 int LFQueue_init(struct LFQueue* me, queue_attr_t* attr);
 int LFQueue_destroy(struct LFQueue* me);
-void LFQueue_cleanup_thread(void);
+
+int LFQueue_pool_set_cache_size(size_t size);
+int LFQueue_pool_get_stats(lfq_pool_stats_t* stats);
+/*
+ * Frees every slab and resets the statistics. Only when no queue or domain is
+ * alive, no LFQueue_pool_alloc() object is in use and no other thread is inside
+ * the library; those threads need not have exited, they drop their stale
+ * caches on their next pool call.
+ */
+void LFQueue_pool_release(void);
+
+int LFQueue_get_stats(struct LFQueue* me, lfq_stats_t* stats); /*all zero except pool when built without LFQ_STATS*/
+int LFQueue_get_scan_stats(lfq_scan_stats_t* stats); /*all zero without LFQ_SCAN_TIMING*/
+bool LFQueue_asymmetric_fence(void); /*LFQ_ASYMMETRIC_FENCE is built in and membarrier(2) accepted the registration*/
+void LFQueue_reset_scan_stats(void);
+
+/*
+ * Enqueue-to-dequeue times of the items dequeued from the queue's domain (all of
+ * its queues if the domain is shared). Always empty when built without LFQ_SOJOURN.
+ */
+int LFQueue_get_sojourn(struct LFQueue* me, lfq_histogram_t* hist);
+void LFQueue_histogram_merge(lfq_histogram_t* dst, const lfq_histogram_t* src);
+unsigned long long LFQueue_histogram_percentile(const lfq_histogram_t* hist, double p); /*p in [0, 1]*/
+
+/*
+ * Items in the queue, summed over LFQ_SIZE_SHARDS counters that only the
+ * enqueuing and dequeuing threads write, so polling it never touches the
+ * head or tail line. Exact when the queue is quiescent, otherwise a snapshot
+ * that may lag by the operations in flight. 0 if the queue tracks no size.
+ */
+size_t LFQueue_size_approx(struct LFQueue* me);
+
+/*
+ * With attr.eventfd the queue owns a non-blocking eventfd for poll/epoll.
+ * It turns readable on the empty to non-empty transition and is written only
+ * then, not per item. Consumers dequeue until LFQ_EEMPTY; the dequeue that
+ * finds the queue empty drains the fd, so it is readable again only once the
+ * next item arrives. -1 without attr.eventfd.
+ */
+int LFQueue_fd(struct LFQueue* me);
 
 lfq_err_t enqueueLF(struct LFQueue* me, int data);
 lfq_err_t dequeueLF(struct LFQueue* me, int* output);
 
+/*
+ * Enqueue n items in order with a single tail CAS. enqueueCallback runs for the
+ * items in order first; if it rejects one, no item is enqueued and LFQ_EUSRDEF is
+ * returned, but what the callbacks did for the earlier items is not undone.
+ * The segment backend enqueues the items one by one; they stay in order but may
+ * interleave with other producers. On the ring backend a batch larger than the
+ * capacity fails with LFQ_EINVAL, as it could never fit.
+ */
+lfq_err_t enqueueLF_bulk(struct LFQueue* me, const int* items, size_t n);
+
+/*Dequeue up to max items in order with a single head CAS; *got receives the number dequeued*/
+lfq_err_t dequeueLF_bulk(struct LFQueue* me, int* out, size_t max, size_t* got);
+
+/*
+ * Dequeue, spinning briefly and then sleeping on a futex until an item arrives.
+ * timeout_ms < 0 waits forever, 0 never sleeps. Returns LFQ_EEMPTY on timeout.
+ */
+lfq_err_t dequeueLF_wait(struct LFQueue* me, int* output, int timeout_ms);
+
+/*
+ * Sharded front-end: N independent lanes with relaxed FIFO. Every thread has a
+ * home lane; producers enqueue there (or on the lane a key hashes to), so the
+ * order of one producer's items is kept. Consumers dequeue from their home lane
+ * and steal from the others when it is empty. All lanes share one domain.
+ */
+struct LFShardedQueue {
+    struct LFQueue* lanes;
+    unsigned num_lanes;
+    hp_domain_t* domain;
+    bool owns_domain;
+};
+
+typedef struct {
+    size_t home_dequeues; /*items found on the consumer's home lane*/
+    size_t steals;        /*items taken from another lane*/
+    size_t empty_sweeps;  /*dequeues that found every lane empty*/
+}lfq_sharded_stats_t;
+
+int LFShardedQueue_init(struct LFShardedQueue* me, unsigned lanes, queue_attr_t* attr);
+int LFShardedQueue_destroy(struct LFShardedQueue* me);
+/*summed over the records of the lanes' domain, like LFQueue_get_stats(); all zero without LFQ_STATS*/
+int LFShardedQueue_get_stats(struct LFShardedQueue* me, lfq_sharded_stats_t* stats);
+unsigned LFShardedQueue_home_lane(struct LFShardedQueue* me); /*the calling thread's lane*/
+void LFShardedQueue_set_home(unsigned ticket); /*pin the calling thread to lane ticket % lanes of every sharded queue*/
+
+lfq_err_t enqueueLF_sharded(struct LFShardedQueue* me, int data); /*home lane*/
+lfq_err_t enqueueLF_sharded_key(struct LFShardedQueue* me, unsigned key, int data); /*lane picked by hashing key*/
+lfq_err_t dequeueLF_sharded(struct LFShardedQueue* me, int* output);
+
+/*
+ * Chase-Lev work-stealing deque (with the C11 orderings of Le et al.). One
+ * owner thread pushes and pops at the bottom with plain loads and stores; only
+ * taking the last item races thieves on a CAS. Any thread may steal from the
+ * top. The circular buffer doubles when full and the old one is retired
+ * through the hazard pointer records of the deque's domain.
+ */
+struct lfq_wsbuf;
+
+struct LFDeque {
+    alignas(CACHE_LINE_SIZE) atomic_llong top;    /*next index to steal, only ever grows*/
+    alignas(CACHE_LINE_SIZE) atomic_llong bottom; /*next free index, written by the owner only*/
+    _Atomic(struct lfq_wsbuf*) buffer;
+    hp_domain_t* domain;
+    bool owns_domain;
+};
+
+int LFDeque_init(struct LFDeque* me, size_t capacity, hp_domain_t* domain); /*capacity rounds up to a power of two; NULL domain: private*/
+int LFDeque_destroy(struct LFDeque* me); /*no push, pop or steal may be in progress*/
+
+lfq_err_t LFDeque_push(struct LFDeque* me, int data);    /*owner only; LFQ_ENOMEM if the buffer cannot grow*/
+lfq_err_t LFDeque_pop(struct LFDeque* me, int* output);  /*owner only, newest item first*/
+lfq_err_t LFDeque_steal(struct LFDeque* me, int* output); /*any thread, oldest item first*/
+size_t LFDeque_size_approx(struct LFDeque* me);
+
 #endif
@@ -0,0 +1,283 @@
+#ifndef _LOCKFREE_QUEUE_HPP_
+#define _LOCKFREE_QUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "LFHazard.h"
+
+/*
+ * lfq::queue<T>: the Michael-Scott queue of LFQueue.c with the item stored in
+ * the node instead of an int, so a message needs no separate allocation.
+ * Nodes are protected and retired through the C library's hazard pointer
+ * domains (LFHazard.h), which give a thread's records back when it exits,
+ * so LFQueue_cleanup_thread() need not be called.
+ *
+ * Nodes up to LFQ_POOL_MAX_OBJECT bytes come from the node pool
+ * (LFQueue_pool_alloc()) and are retired against the node threshold, as on the
+ * int path; larger or over-aligned ones use operator new and the block bound.
+ * Each carries a 16-byte lfq_block_t header in front of next and the item so
+ * that Scan() can free it through the block's reclaim function.
+ *
+ * T has to be constructible from the emplace() arguments and move assignable.
+ * try_pop() moves the item out and destroys the moved-from copy in the node; if
+ * the move assignment throws, the item is already off the queue and is dropped,
+ * and the exception propagates. Allocation failures throw std::bad_alloc.
+ */
+namespace lfq {
+
+static_assert(sizeof(std::atomic<void*>) == sizeof(void*) && std::atomic<void*>::is_always_lock_free,
+              "hazard pointer slots are shared with C as plain atomic pointers");
+
+template <typename T>
+class queue
+{
+public:
+    queue() : queue(nullptr) {}
+
+    /*domain == nullptr: the queue creates and owns a private domain*/
+    explicit queue(hp_domain_t* domain) : domain_(domain), domain_id_(0), owns_domain_(false)
+    {
+        if (!domain_)
+        {
+            domain_ = hp_domain_create();
+            if (!domain_)
+            {
+                throw std::bad_alloc();
+            }
+            owns_domain_ = true;
+        }
+        domain_id_ = hp_domain_id(domain_);
+
+        node* dummy = node::create();
+        head_.store(dummy, std::memory_order_relaxed);
+        tail_.store(dummy, std::memory_order_relaxed);
+    }
+
+    queue(const queue&) = delete;
+    queue& operator=(const queue&) = delete;
+
+    /*no other thread may use the queue any more*/
+    ~queue()
+    {
+        node* h = head_.load(std::memory_order_relaxed);
+        node* next = h->next.load(std::memory_order_relaxed);
+        while (next)
+        {
+            next->value()->~T();
+            node::destroy(h);
+            h = next;
+            next = h->next.load(std::memory_order_relaxed);
+        }
+        node::destroy(h);
+
+        if (owns_domain_)
+        {
+            hp_domain_destroy(domain_);
+        }
+    }
+
+    template <typename... Args>
+    void emplace(Args&&... args)
+    {
+        std::atomic<void*>* hp = slots(record());
+        node* n = node::create();
+        try
+        {
+            ::new (static_cast<void*>(n->storage)) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            node::destroy(n);
+            throw;
+        }
+
+        node* t;
+        while (true)
+        {
+            t = tail_.load(std::memory_order_acquire);
+            if (!protect(hp[0], t, tail_))
+            {
+                continue;
+            }
+
+            node* next = t->next.load(std::memory_order_acquire);
+            if (next)
+            {
+                tail_.compare_exchange_strong(t, next, std::memory_order_acq_rel, std::memory_order_relaxed);
+                continue;
+            }
+
+            node* expected = nullptr;
+            if (t->next.compare_exchange_strong(expected, n, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        tail_.compare_exchange_strong(t, n, std::memory_order_acq_rel, std::memory_order_relaxed);
+        hp[0].store(nullptr, std::memory_order_release);
+    }
+
+    void push(const T& item) { emplace(item); }
+    void push(T&& item) { emplace(std::move(item)); }
+
+    /*false if the queue was empty*/
+    bool try_pop(T& out)
+    {
+        hp_record_t* rec = record();
+        std::atomic<void*>* hp = slots(rec);
+        node* h;
+        node* next;
+        while (true)
+        {
+            h = head_.load(std::memory_order_acquire);
+            if (!protect(hp[0], h, head_))
+            {
+                continue;
+            }
+
+            node* t = tail_.load(std::memory_order_acquire);
+            next = h->next.load(std::memory_order_acquire);
+            if (!protect(hp[1], next, head_, h))
+            {
+                continue;
+            }
+
+            if (!next)
+            {
+                hp[0].store(nullptr, std::memory_order_release);
+                hp[1].store(nullptr, std::memory_order_release);
+                return false;
+            }
+
+            if (h == t)
+            {
+                tail_.compare_exchange_strong(t, next, std::memory_order_acq_rel, std::memory_order_relaxed);
+                continue;
+            }
+
+            if (head_.compare_exchange_strong(h, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+
+        /*next is the new dummy; its item is ours and nobody else reads it (for trivially copyable T: a copy, no destructor)*/
+        T* item = next->value();
+        try
+        {
+            out = std::move(*item);
+        }
+        catch (...)
+        {
+            item->~T();
+            release(rec, hp, h);
+            throw;
+        }
+        item->~T();
+        release(rec, hp, h);
+        return true;
+    }
+
+private:
+    /*block first, so that the node, its block and the published hazard pointer share one address*/
+    struct node
+    {
+        lfq_block_t block;
+        std::atomic<node*> next;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        node() : block{nullptr, &node::reclaim}, next(nullptr) {}
+        T* value() { return std::launder(reinterpret_cast<T*>(storage)); }
+
+        static node* create();
+        static void destroy(node* n);
+        static void reclaim(lfq_block_t* block) { destroy(reinterpret_cast<node*>(block)); }
+    };
+
+    static_assert(std::is_standard_layout<node>::value, "node must start with its block");
+
+    /*what the pool serves: small enough, and no stricter alignment than malloc() gives*/
+    static constexpr bool pooled =
+        sizeof(node) <= LFQ_POOL_MAX_OBJECT && alignof(node) <= alignof(std::max_align_t);
+
+    hp_record_t* record()
+    {
+        hp_record_t* rec = hp_thread_record(domain_, domain_id_);
+        if (!rec)
+        {
+            throw std::bad_alloc();
+        }
+        return rec;
+    }
+
+    /*clear the hazard pointers of try_pop() and retire the old dummy*/
+    static void release(hp_record_t* rec, std::atomic<void*>* hp, node* h)
+    {
+        hp[0].store(nullptr, std::memory_order_release);
+        hp[1].store(nullptr, std::memory_order_release);
+        if (pooled)
+        {
+            hp_retire_small_block(rec, &h->block);
+        }
+        else
+        {
+            hp_retire_block(rec, &h->block);
+        }
+    }
+
+    static std::atomic<void*>* slots(hp_record_t* rec) { return static_cast<std::atomic<void*>*>(hp_record_slots(rec)); }
+
+    /*publish p, then make sure src still holds expect (p by default) so that p was not retired before*/
+    static bool protect(std::atomic<void*>& slot, node* p, const std::atomic<node*>& src)
+    {
+        return protect(slot, p, src, p);
+    }
+
+    static bool protect(std::atomic<void*>& slot, node* p, const std::atomic<node*>& src, node* expect)
+    {
+        slot.store(p, std::memory_order_seq_cst);
+        return src.load(std::memory_order_seq_cst) == expect;
+    }
+
+    alignas(64) std::atomic<node*> head_;
+    alignas(64) std::atomic<node*> tail_;
+    hp_domain_t* domain_;
+    unsigned long long domain_id_;
+    bool owns_domain_;
+};
+
+template <typename T>
+typename queue<T>::node* queue<T>::node::create()
+{
+    if (!pooled)
+    {
+        return new node;
+    }
+
+    void* p = LFQueue_pool_alloc(sizeof(node));
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return ::new (p) node;
+}
+
+template <typename T>
+void queue<T>::node::destroy(node* n)
+{
+    if (!pooled)
+    {
+        delete n;
+        return;
+    }
+
+    n->~node();
+    LFQueue_pool_free(n, sizeof(node));
+}
+
+} // namespace lfq
+
+#endif
@@ -0,0 +1,948 @@
+#define _GNU_SOURCE
+#include "LFShmQueue.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*the same words are used by every process that maps the arena*/
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "shared atomics must be lock-free");
+
+#define SHM_MAGIC (0x4c46512d53484d02ULL) /*"LFQ-SHM" and the layout version*/
+#define SHM_NULL (0u) /*offset 0 is the header, never a node*/
+
+typedef struct
+{
+    _Atomic(uint32_t) next; /*offset of the next node in the queue, SHM_NULL at the tail*/
+    _Atomic(uint32_t) link; /*offset of the next node on the free list or a retired list*/
+    int data;
+    uint32_t unused;
+} shm_node_t;
+
+typedef struct
+{
+    _Atomic(uint64_t) owner; /*identity of the process whose thread holds the record, 0: free; see shm_self()*/
+    _Atomic(uint64_t) handle; /*id of the owner's LFShmQueue handle, 0 while being claimed or free*/
+    _Atomic(uint32_t) HP[LFQ_HP_SLOTS];
+    uint32_t rlist; /*retired nodes linked through link; touched only by whoever holds the record*/
+    uint32_t rcount;
+} __attribute__ ((aligned (CACHE_LINE_SIZE))) shm_record_t;
+
+struct lfq_shm_header
+{
+    _Atomic(uint64_t) magic; /*written last by LFShmQueue_format()*/
+    uint64_t size;
+    uint32_t records;
+    uint32_t nodes;
+    uint32_t records_off;
+    uint32_t nodes_off;
+    uint32_t retire_threshold;
+    alignas(CACHE_LINE_SIZE) _Atomic(uint64_t) head; /*tag << 32 | offset*/
+    alignas(CACHE_LINE_SIZE) _Atomic(uint64_t) tail;
+    alignas(CACHE_LINE_SIZE) _Atomic(uint64_t) free_list;
+};
+
+static inline uint32_t tp_off(uint64_t word)
+{
+    return (uint32_t)word;
+}
+
+/*the word that replaces old: offset off, tag one higher, so a recycled offset never matches a stale copy*/
+static inline uint64_t tp_next(uint64_t old, uint32_t off)
+{
+    return ((old >> 32) + 1) << 32 | off;
+}
+
+static inline shm_node_t *shm_node(struct lfq_shm_header *hdr, uint32_t off)
+{
+    return (shm_node_t *)((char *)hdr + off);
+}
+
+static inline shm_record_t *shm_record(struct lfq_shm_header *hdr, unsigned i)
+{
+    return (shm_record_t *)((char *)hdr + hdr->records_off) + i;
+}
+
+static size_t shm_records_off(void)
+{
+    return (sizeof(struct lfq_shm_header) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+}
+
+size_t LFShmQueue_arena_size(size_t capacity, unsigned records)
+{
+    /*one more node for the dummy*/
+    return shm_records_off() + (size_t)records * sizeof(shm_record_t) + (capacity + 1) * sizeof(shm_node_t);
+}
+
+int LFShmQueue_format(void *mem, size_t size, unsigned records)
+{
+    if (!mem || ((uintptr_t)mem & (CACHE_LINE_SIZE - 1)) || records == 0 || records > LFQ_SHM_MAX_RECORDS ||
+        size > UINT32_MAX || size < LFShmQueue_arena_size(1, records))
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    struct lfq_shm_header *hdr = mem;
+    memset(hdr, 0, shm_records_off() + (size_t)records * sizeof(shm_record_t));
+    hdr->size = size;
+    hdr->records = records;
+    hdr->records_off = (uint32_t)shm_records_off();
+    hdr->nodes_off = hdr->records_off + records * (uint32_t)sizeof(shm_record_t);
+    hdr->nodes = (uint32_t)((size - hdr->nodes_off) / sizeof(shm_node_t));
+
+    /*what live threads may keep retired must not add up to a full arena*/
+    uint32_t threshold = 2 * LFQ_HP_SLOTS * records;
+    if (threshold > hdr->nodes / (2 * records))
+    {
+        threshold = hdr->nodes / (2 * records);
+    }
+    hdr->retire_threshold = threshold ? threshold : 1;
+
+    for (unsigned i = 0; i < records; i++)
+    {
+        shm_record_t *rec = shm_record(hdr, i);
+        atomic_init(&rec->owner, 0);
+        atomic_init(&rec->handle, 0);
+        for (unsigned k = 0; k < LFQ_HP_SLOTS; k++)
+        {
+            atomic_init(&rec->HP[k], SHM_NULL);
+        }
+        rec->rlist = SHM_NULL;
+        rec->rcount = 0;
+    }
+
+    /*node 0 is the dummy, the others go on the free list in address order*/
+    for (uint32_t i = 0; i < hdr->nodes; i++)
+    {
+        uint32_t off = hdr->nodes_off + i * (uint32_t)sizeof(shm_node_t);
+        shm_node_t *node = shm_node(hdr, off);
+        atomic_init(&node->next, SHM_NULL);
+        atomic_init(&node->link, (i > 0 && i + 1 < hdr->nodes) ? off + (uint32_t)sizeof(shm_node_t) : SHM_NULL);
+        node->data = 0;
+        node->unused = 0;
+    }
+    atomic_init(&hdr->head, hdr->nodes_off);
+    atomic_init(&hdr->tail, hdr->nodes_off);
+    atomic_init(&hdr->free_list, hdr->nodes > 1 ? hdr->nodes_off + (uint32_t)sizeof(shm_node_t) : SHM_NULL);
+
+    atomic_store_explicit(&hdr->magic, SHM_MAGIC, memory_order_release);
+    return 0;
+}
+
+/*Free list: a Treiber stack whose tag keeps a pop from succeeding on a node that left and came back*/
+static uint32_t shm_pop_free(struct lfq_shm_header *hdr)
+{
+    uint64_t old = atomic_load_explicit(&hdr->free_list, memory_order_acquire);
+    while (tp_off(old) != SHM_NULL)
+    {
+        /*the node may be popped and reused under us: link is then stale, and the tag fails the CAS*/
+        uint32_t next = atomic_load_explicit(&shm_node(hdr, tp_off(old))->link, memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&hdr->free_list, &old, tp_next(old, next), memory_order_acquire,
+                                                  memory_order_acquire))
+        {
+            return tp_off(old);
+        }
+    }
+    return SHM_NULL;
+}
+
+static void shm_push_free(struct lfq_shm_header *hdr, uint32_t first, uint32_t last)
+{
+    uint64_t old = atomic_load_explicit(&hdr->free_list, memory_order_relaxed);
+    do
+    {
+        atomic_store_explicit(&shm_node(hdr, last)->link, tp_off(old), memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&hdr->free_list, &old, tp_next(old, first), memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static void shm_offset_sift_down(uint32_t *offs, size_t root, size_t count)
+{
+    uint32_t value = offs[root];
+    size_t child;
+    while ((child = 2 * root + 1) < count)
+    {
+        if (child + 1 < count && offs[child + 1] > offs[child])
+        {
+            child++;
+        }
+        if (offs[child] <= value)
+        {
+            break;
+        }
+        offs[root] = offs[child];
+        root = child;
+    }
+    offs[root] = value;
+}
+
+/*Heapsort in place: qsort() may malloc once the array passes 1 KB*/
+static void shm_offset_sort(uint32_t *offs, size_t count)
+{
+    for (size_t i = count / 2; i-- > 0;)
+    {
+        shm_offset_sift_down(offs, i, count);
+    }
+    for (size_t end = count; end-- > 1;)
+    {
+        uint32_t top = offs[0];
+        offs[0] = offs[end];
+        offs[end] = top;
+        shm_offset_sift_down(offs, 0, end);
+    }
+}
+
+static bool shm_offset_contains(const uint32_t *offs, size_t count, uint32_t off)
+{
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi)
+    {
+        size_t mid = lo + ((hi - lo) >> 1);
+        if (offs[mid] < off)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo < count && offs[lo] == off;
+}
+
+/*Free the retired nodes of myrec that no hazard pointer of any process holds*/
+static void shm_scan(struct lfq_shm_header *hdr, shm_record_t *myrec)
+{
+    uint32_t hps[LFQ_SHM_MAX_RECORDS * LFQ_HP_SLOTS];
+    size_t count = 0;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    for (unsigned i = 0; i < hdr->records; i++)
+    {
+        shm_record_t *rec = shm_record(hdr, i);
+        for (unsigned k = 0; k < LFQ_HP_SLOTS; k++)
+        {
+            uint32_t hp = atomic_load_explicit(&rec->HP[k], memory_order_acquire);
+            if (hp != SHM_NULL)
+            {
+                hps[count++] = hp;
+            }
+        }
+    }
+    shm_offset_sort(hps, count);
+
+    uint32_t list = myrec->rlist;
+    myrec->rlist = SHM_NULL;
+    myrec->rcount = 0;
+    uint32_t free_first = SHM_NULL;
+    uint32_t free_last = SHM_NULL;
+    while (list != SHM_NULL)
+    {
+        shm_node_t *node = shm_node(hdr, list);
+        uint32_t next = atomic_load_explicit(&node->link, memory_order_relaxed);
+        if (shm_offset_contains(hps, count, list))
+        {
+            atomic_store_explicit(&node->link, myrec->rlist, memory_order_relaxed);
+            myrec->rlist = list;
+            myrec->rcount++;
+        }
+        else
+        {
+            atomic_store_explicit(&node->link, free_first, memory_order_relaxed);
+            if (free_last == SHM_NULL)
+            {
+                free_last = list;
+            }
+            free_first = list;
+        }
+        list = next;
+    }
+
+    if (free_first != SHM_NULL)
+    {
+        shm_push_free(hdr, free_first, free_last);
+    }
+}
+
+/*Give a record back; its retired list stays for the next owner or a helper*/
+static void shm_record_release(shm_record_t *rec)
+{
+    for (unsigned k = 0; k < LFQ_HP_SLOTS; k++)
+    {
+        atomic_store_explicit(&rec->HP[k], SHM_NULL, memory_order_release);
+    }
+    atomic_store_explicit(&rec->handle, 0, memory_order_relaxed);
+    atomic_store_explicit(&rec->owner, 0, memory_order_release);
+}
+
+/*
+ * A process is named by its pid in the low half of a word and the low 32 bits
+ * of its start time (clock ticks since boot, /proc/<pid>/stat) in the high
+ * half, so that a record whose owner died is still recognised once another
+ * process has been given the same pid. One CAS sets both halves.
+ */
+static inline int shm_owner_pid(uint64_t owner)
+{
+    return (int)(uint32_t)owner;
+}
+
+/*0 if unknown: not Linux, or /proc not readable*/
+static uint32_t shm_start_time(int pid)
+{
+#ifdef __linux__
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return 0;
+    }
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+
+    /*the command name (field 2) may hold spaces and parentheses, so count from its closing one to starttime, field 22*/
+    char *p = strrchr(buf, ')');
+    for (int field = 2; p && field < 22; field++)
+    {
+        p = strchr(p + 1, ' ');
+    }
+    unsigned long long start = 0;
+    if (!p || sscanf(p, " %llu", &start) != 1)
+    {
+        return 0;
+    }
+    return (uint32_t)start;
+#else
+    (void)pid;
+    return 0;
+#endif
+}
+
+static uint64_t shm_identity(int pid, uint32_t start)
+{
+    return (uint64_t)start << 32 | (uint32_t)pid;
+}
+
+static _Atomic(uint64_t) g_shmSelf = ATOMIC_VAR_INIT(0);
+
+/*the calling process, cached per pid so that a forked child reads its own*/
+static uint64_t shm_self(void)
+{
+    int pid = getpid();
+    uint64_t self = atomic_load_explicit(&g_shmSelf, memory_order_relaxed);
+    if (self == 0 || shm_owner_pid(self) != pid)
+    {
+        self = shm_identity(pid, shm_start_time(pid));
+        atomic_store_explicit(&g_shmSelf, self, memory_order_relaxed);
+    }
+    return self;
+}
+
+static bool shm_owner_dead(uint64_t owner)
+{
+    int pid = shm_owner_pid(owner);
+    if (kill(pid, 0) != 0 && errno == ESRCH)
+    {
+        return true;
+    }
+
+    /*the pid is in use, maybe by a later process; without a start time on either side assume the owner*/
+    uint32_t start = (uint32_t)(owner >> 32);
+    uint32_t now = start ? shm_start_time(pid) : 0;
+    return now != 0 && now != start;
+}
+
+/*
+ * Recover the records of dead processes, and with myrec also take over the
+ * retired nodes parked in free records. A record is claimed by a CAS of its
+ * owner to our identity first, so two helpers never work on the same one.
+ */
+static unsigned shm_help(struct lfq_shm_header *hdr, shm_record_t *myrec)
+{
+    uint64_t self = shm_self();
+    unsigned recovered = 0;
+    for (unsigned i = 0; i < hdr->records; i++)
+    {
+        shm_record_t *rec = shm_record(hdr, i);
+        if (rec == myrec)
+        {
+            continue;
+        }
+
+        uint64_t owner = atomic_load_explicit(&rec->owner, memory_order_acquire);
+        bool dead = owner != 0 && owner != self && shm_owner_dead(owner);
+        if ((owner != 0 || !myrec) && !dead)
+        {
+            continue;
+        }
+        if (!atomic_compare_exchange_strong_explicit(&rec->owner, &owner, self, memory_order_acquire,
+                                                     memory_order_relaxed))
+        {
+            continue;
+        }
+
+        while (myrec && rec->rlist != SHM_NULL)
+        {
+            uint32_t off = rec->rlist;
+            shm_node_t *node = shm_node(hdr, off);
+            rec->rlist = atomic_load_explicit(&node->link, memory_order_relaxed);
+            atomic_store_explicit(&node->link, myrec->rlist, memory_order_relaxed);
+            myrec->rlist = off;
+            myrec->rcount++;
+        }
+        if (myrec)
+        {
+            rec->rcount = 0;
+        }
+
+        shm_record_release(rec);
+        recovered += dead;
+    }
+    return recovered;
+}
+
+static shm_record_t *shm_record_claim(struct lfq_shm_header *hdr)
+{
+    uint64_t self = shm_self();
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        for (unsigned i = 0; i < hdr->records; i++)
+        {
+            shm_record_t *rec = shm_record(hdr, i);
+            uint64_t expected = 0;
+            if (atomic_load_explicit(&rec->owner, memory_order_relaxed) == 0 &&
+                atomic_compare_exchange_strong_explicit(&rec->owner, &expected, self, memory_order_acquire,
+                                                        memory_order_relaxed))
+            {
+                return rec;
+            }
+        }
+
+        /*all taken: some may belong to processes that are gone*/
+        if (attempt == 0 && shm_help(hdr, NULL) == 0)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Per-thread records, as for hazard pointer domains: sets of
+ * LFQ_SHM_THREAD_WAYS slots in most recently used order, picked by handle id,
+ * so handles whose ids collide do not evict each other on every operation;
+ * handles registered while open so that a thread exiting after detach
+ * leaves the arena alone, and a pthread key that releases the records of an
+ * exiting thread. A forked child starts without records: the slots it inherits
+ * name its parent's.
+ */
+typedef struct
+{
+    struct LFShmQueue *queue;
+    unsigned long long id;
+    shm_record_t *record;
+} shm_thread_slot_t;
+
+_Static_assert(LFQ_SHM_THREAD_SLOTS % LFQ_SHM_THREAD_WAYS == 0, "the slots split evenly into sets");
+static _Thread_local shm_thread_slot_t g_threadShmSlots[LFQ_SHM_THREAD_SLOTS];
+static _Thread_local bool g_threadShmExitArmed = false;
+
+static pthread_mutex_t g_shmRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static struct LFShmQueue *g_shmRegistry = NULL;
+static atomic_ullong g_shmNextId = ATOMIC_VAR_INIT(1);
+static pthread_key_t g_shmExitKey;
+static pthread_once_t g_shmOnce = PTHREAD_ONCE_INIT;
+static bool g_shmExitKeyValid = false;
+
+/*Caller holds g_shmRegistryLock*/
+static bool shm_queue_is_live(const shm_thread_slot_t *slot)
+{
+    for (struct LFShmQueue *queue = g_shmRegistry; queue; queue = queue->registry_next)
+    {
+        if (queue == slot->queue && queue->id == slot->id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void shm_thread_slot_release(shm_thread_slot_t *slot)
+{
+    if (!slot->record)
+    {
+        return;
+    }
+
+    /*only the liveness check under the lock; releasing keeps the handle from being detached meanwhile*/
+    pthread_mutex_lock(&g_shmRegistryLock);
+    bool live = shm_queue_is_live(slot);
+    if (live)
+    {
+        atomic_fetch_add_explicit(&slot->queue->releasing, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_shmRegistryLock);
+
+    if (live)
+    {
+        if (slot->record->rcount)
+        {
+            shm_scan(slot->queue->hdr, slot->record);
+        }
+        shm_record_release(slot->record);
+        atomic_fetch_sub_explicit(&slot->queue->releasing, 1, memory_order_release);
+    }
+
+    slot->queue = NULL;
+    slot->id = 0;
+    slot->record = NULL;
+}
+
+static void shm_thread_exit(void *arg)
+{
+    (void)arg;
+    for (unsigned i = 0; i < LFQ_SHM_THREAD_SLOTS; i++)
+    {
+        shm_thread_slot_release(&g_threadShmSlots[i]);
+    }
+    g_threadShmExitArmed = false;
+}
+
+static void shm_fork_child(void)
+{
+    memset(g_threadShmSlots, 0, sizeof(g_threadShmSlots));
+}
+
+static void shm_once(void)
+{
+    g_shmExitKeyValid = pthread_key_create(&g_shmExitKey, shm_thread_exit) == 0;
+    if (!g_shmExitKeyValid)
+    {
+        LFQueue_error_callback("%s: pthread_key_create() failed, records are kept until detach\n", __func__);
+    }
+    pthread_atfork(NULL, NULL, shm_fork_child);
+}
+
+/*the set of LFQ_SHM_THREAD_WAYS slots that me's id maps to*/
+static inline shm_thread_slot_t *shm_thread_set(const struct LFShmQueue *me)
+{
+    return &g_threadShmSlots[(me->id & (LFQ_SHM_THREAD_SLOTS / LFQ_SHM_THREAD_WAYS - 1)) * LFQ_SHM_THREAD_WAYS];
+}
+
+static shm_record_t *shm_thread_record(struct LFShmQueue *me)
+{
+    shm_thread_slot_t *set = shm_thread_set(me);
+    if (set[0].queue == me && set[0].id == me->id)
+    {
+        return set[0].record;
+    }
+
+    for (unsigned i = 1; i < LFQ_SHM_THREAD_WAYS; i++)
+    {
+        if (set[i].queue == me && set[i].id == me->id)
+        {
+            shm_thread_slot_t hit = set[i];
+            memmove(&set[1], &set[0], i * sizeof(set[0]));
+            set[0] = hit;
+            return hit.record;
+        }
+    }
+
+    /*an empty way if there is one, else the least recently used (last) way, whose record goes back*/
+    unsigned way = LFQ_SHM_THREAD_WAYS - 1;
+    for (unsigned i = 0; i < LFQ_SHM_THREAD_WAYS; i++)
+    {
+        if (!set[i].record)
+        {
+            way = i;
+            break;
+        }
+    }
+    shm_thread_slot_release(&set[way]);
+
+    shm_record_t *rec = shm_record_claim(me->hdr);
+    if (!rec)
+    {
+        LFQueue_error_callback("%s: all %u records are in use\n", __func__, me->hdr->records);
+        return NULL;
+    }
+    atomic_store_explicit(&rec->handle, me->id, memory_order_relaxed);
+
+    if (!g_threadShmExitArmed && g_shmExitKeyValid && pthread_setspecific(g_shmExitKey, &g_threadShmExitArmed) == 0)
+    {
+        g_threadShmExitArmed = true;
+    }
+
+    /*the new slot goes first, as the most recently used*/
+    memmove(&set[1], &set[0], way * sizeof(set[0]));
+    set[0].queue = me;
+    set[0].id = me->id;
+    set[0].record = rec;
+    return rec;
+}
+
+int LFShmQueue_open(struct LFShmQueue *me, void *mem, size_t size)
+{
+    if (!me || !mem)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    struct lfq_shm_header *hdr = mem;
+    if (size < sizeof(*hdr) || atomic_load_explicit(&hdr->magic, memory_order_acquire) != SHM_MAGIC ||
+        hdr->size != size)
+    {
+        LFQueue_error_callback("%s: not a formatted arena of %zu bytes\n", __func__, size);
+        return -1;
+    }
+
+    pthread_once(&g_shmOnce, shm_once);
+    me->hdr = hdr;
+    me->size = size;
+    me->mapped = false;
+    me->id = atomic_fetch_add_explicit(&g_shmNextId, 1, memory_order_relaxed);
+    atomic_init(&me->releasing, 0);
+
+    pthread_mutex_lock(&g_shmRegistryLock);
+    me->registry_next = g_shmRegistry;
+    g_shmRegistry = me;
+    pthread_mutex_unlock(&g_shmRegistryLock);
+
+    /*a restarted worker clears up after the one that crashed*/
+    shm_help(hdr, NULL);
+    return 0;
+}
+
+int LFShmQueue_create(struct LFShmQueue *me, const char *name, size_t size, unsigned records)
+{
+    if (!me || !name)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        LFQueue_error_callback("%s: shm_open() failed: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+    {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        LFQueue_error_callback("%s: ftruncate()/mmap() failed: %s\n", __func__, strerror(errno));
+        shm_unlink(name);
+        return -1;
+    }
+
+    if (LFShmQueue_format(mem, size, records) != 0 || LFShmQueue_open(me, mem, size) != 0)
+    {
+        munmap(mem, size);
+        shm_unlink(name);
+        return -1;
+    }
+    me->mapped = true;
+    return 0;
+}
+
+int LFShmQueue_attach(struct LFShmQueue *me, const char *name)
+{
+    if (!me || !name)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        LFQueue_error_callback("%s: shm_open() failed: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        mem = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        LFQueue_error_callback("%s: %s is not ready\n", __func__, name);
+        return -1;
+    }
+
+    if (LFShmQueue_open(me, mem, (size_t)st.st_size) != 0)
+    {
+        munmap(mem, (size_t)st.st_size);
+        return -1;
+    }
+    me->mapped = true;
+    return 0;
+}
+
+int LFShmQueue_unlink(const char *name)
+{
+    if (!name)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    return shm_unlink(name);
+}
+
+int LFShmQueue_detach(struct LFShmQueue *me)
+{
+    if (!me || !me->hdr)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return -1;
+    }
+
+    shm_thread_slot_t *set = shm_thread_set(me);
+    for (unsigned i = 0; i < LFQ_SHM_THREAD_WAYS; i++)
+    {
+        if (set[i].queue == me && set[i].id == me->id)
+        {
+            shm_thread_slot_release(&set[i]);
+        }
+    }
+
+    pthread_mutex_lock(&g_shmRegistryLock);
+    struct LFShmQueue **link = &g_shmRegistry;
+    while (*link && *link != me)
+    {
+        link = &(*link)->registry_next;
+    }
+    if (*link)
+    {
+        *link = me->registry_next;
+    }
+    pthread_mutex_unlock(&g_shmRegistryLock);
+
+    /*exiting threads that found the handle registered are still giving their records back*/
+    while (atomic_load_explicit(&me->releasing, memory_order_acquire))
+    {
+        sched_yield();
+    }
+
+    /*records other threads of this process still hold through this handle; other handles keep theirs*/
+    uint64_t self = shm_self();
+    for (unsigned i = 0; i < me->hdr->records; i++)
+    {
+        shm_record_t *rec = shm_record(me->hdr, i);
+        if (atomic_load_explicit(&rec->owner, memory_order_relaxed) == self &&
+            atomic_load_explicit(&rec->handle, memory_order_relaxed) == me->id)
+        {
+            shm_record_release(rec);
+        }
+    }
+
+    if (me->mapped)
+    {
+        munmap(me->hdr, me->size);
+    }
+    me->hdr = NULL;
+    return 0;
+}
+
+unsigned LFShmQueue_recover(struct LFShmQueue *me)
+{
+    if (!me || !me->hdr)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    return shm_help(me->hdr, shm_thread_record(me));
+}
+
+size_t LFShmQueue_capacity(struct LFShmQueue *me)
+{
+    if (!me || !me->hdr)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return 0;
+    }
+
+    return me->hdr->nodes - 1;
+}
+
+/*Publish off in slot k, then make sure src still holds expect so that off was not retired before*/
+static inline bool shm_protect(shm_record_t *myrec, unsigned k, uint32_t off, _Atomic(uint64_t) *src, uint64_t expect)
+{
+    atomic_store_explicit(&myrec->HP[k], off, memory_order_seq_cst);
+    return atomic_load_explicit(src, memory_order_seq_cst) == expect;
+}
+
+static uint32_t shm_node_alloc(struct lfq_shm_header *hdr, shm_record_t *myrec)
+{
+    uint32_t off = shm_pop_free(hdr);
+    if (off != SHM_NULL)
+    {
+        return off;
+    }
+
+    /*free what this thread holds, then what dead processes and released records hold*/
+    if (myrec->rcount)
+    {
+        shm_scan(hdr, myrec);
+        off = shm_pop_free(hdr);
+    }
+    if (off == SHM_NULL)
+    {
+        shm_help(hdr, myrec);
+        if (myrec->rcount)
+        {
+            shm_scan(hdr, myrec);
+        }
+        off = shm_pop_free(hdr);
+    }
+    return off;
+}
+
+lfq_err_t enqueueLF_shm(struct LFShmQueue *me, int data)
+{
+    if (!me || !me->hdr)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    struct lfq_shm_header *hdr = me->hdr;
+    shm_record_t *myrec = shm_thread_record(me);
+    if (!myrec)
+    {
+        return LFQ_ENOMEM;
+    }
+
+    uint32_t off = shm_node_alloc(hdr, myrec);
+    if (off == SHM_NULL)
+    {
+        return LFQ_EFULL;
+    }
+    shm_node_t *node = shm_node(hdr, off);
+    node->data = data;
+    atomic_store_explicit(&node->next, SHM_NULL, memory_order_relaxed);
+
+    uint64_t t;
+    while (1)
+    {
+        t = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+        if (!shm_protect(myrec, 0, tp_off(t), &hdr->tail, t))
+        {
+            continue;
+        }
+
+        uint32_t next = atomic_load_explicit(&shm_node(hdr, tp_off(t))->next, memory_order_acquire);
+        if (next != SHM_NULL)
+        {
+            atomic_compare_exchange_strong_explicit(&hdr->tail, &t, tp_next(t, next), memory_order_acq_rel,
+                                                    memory_order_relaxed);
+            continue;
+        }
+
+        uint32_t expected = SHM_NULL;
+        if (atomic_compare_exchange_strong_explicit(&shm_node(hdr, tp_off(t))->next, &expected, off,
+                                                    memory_order_seq_cst, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    atomic_compare_exchange_strong_explicit(&hdr->tail, &t, tp_next(t, off), memory_order_acq_rel,
+                                            memory_order_relaxed);
+    atomic_store_explicit(&myrec->HP[0], SHM_NULL, memory_order_release);
+
+    return LFQ_OK;
+}
+
+lfq_err_t dequeueLF_shm(struct LFShmQueue *me, int *output)
+{
+    if (!me || !me->hdr || !output)
+    {
+        LFQueue_error_callback("%s: invalid input\n", __func__);
+        return LFQ_EINVAL;
+    }
+
+    struct lfq_shm_header *hdr = me->hdr;
+    shm_record_t *myrec = shm_thread_record(me);
+    if (!myrec)
+    {
+        return LFQ_ENOMEM;
+    }
+
+    uint64_t h;
+    uint32_t next;
+    while (1)
+    {
+        h = atomic_load_explicit(&hdr->head, memory_order_acquire);
+        if (!shm_protect(myrec, 0, tp_off(h), &hdr->head, h))
+        {
+            continue;
+        }
+
+        uint64_t t = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+        next = atomic_load_explicit(&shm_node(hdr, tp_off(h))->next, memory_order_acquire);
+        if (!shm_protect(myrec, 1, next, &hdr->head, h))
+        {
+            continue;
+        }
+
+        if (next == SHM_NULL)
+        { /*is empty*/
+            atomic_store_explicit(&myrec->HP[0], SHM_NULL, memory_order_release);
+            atomic_store_explicit(&myrec->HP[1], SHM_NULL, memory_order_release);
+            return LFQ_EEMPTY;
+        }
+
+        if (tp_off(h) == tp_off(t))
+        {
+            atomic_compare_exchange_strong_explicit(&hdr->tail, &t, tp_next(t, next), memory_order_acq_rel,
+                                                    memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_strong_explicit(&hdr->head, &h, tp_next(h, next), memory_order_acq_rel,
+                                                    memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    *output = shm_node(hdr, next)->data;
+    atomic_store_explicit(&myrec->HP[0], SHM_NULL, memory_order_release);
+    atomic_store_explicit(&myrec->HP[1], SHM_NULL, memory_order_release);
+
+    /*retire the old dummy; next of a retired node is left alone, so a late enqueuer still sees it non-NULL*/
+    uint32_t off = tp_off(h);
+    atomic_store_explicit(&shm_node(hdr, off)->link, myrec->rlist, memory_order_relaxed);
+    myrec->rlist = off;
+    if (++myrec->rcount >= hdr->retire_threshold)
+    {
+        shm_scan(hdr, myrec);
+    }
+
+    return LFQ_OK;
+}
@@ -0,0 +1,71 @@
+#ifndef _LOCKFREE_SHM_QUEUE_H_
+#define _LOCKFREE_SHM_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "LFQueue.h"
+
+/*
+ * Process-shared variant of the Michael-Scott queue. The header, the nodes,
+ * the hazard pointer records and the free list all live in one arena, which
+ * the caller maps (MAP_SHARED) or which LFShmQueue_create() takes from
+ * shm_open(). Everything inside is addressed by 32-bit offsets from the arena
+ * start, so each process may map it at its own address. Head, tail and the free
+ * list are 64-bit words of offset and a tag that every CAS bumps. Enqueue and
+ * dequeue use atomics only, without syscalls. The node count of the arena bounds
+ * the queue, so enqueue returns LFQ_EFULL when no node is free.
+ *
+ * Each thread holds a record stamped with the pid of its process and, on Linux,
+ * the process start time from /proc, so a pid that has been reused does not
+ * keep a dead owner's record claimed. Records of processes that have died are
+ * recovered on attach, when the free list runs dry, and by LFShmQueue_recover():
+ * their hazard pointers are cleared and their retired nodes are taken over.
+ * Where /proc cannot be read only the pid is checked, and a record stays claimed
+ * while an unrelated process has its owner's pid. A process killed in the middle
+ * of an operation can leak the node it was moving. Processes must share a pid
+ * namespace.
+ */
+#define LFQ_SHM_MAX_RECORDS (256) /*threads of all processes using one arena at once*/
+#define LFQ_SHM_THREAD_SLOTS (16) /*arenas a thread can hold a record in at once, power of two*/
+#define LFQ_SHM_THREAD_WAYS (4) /*slots per set of that table; handles hashing to one set only evict beyond this*/
+
+struct lfq_shm_header;
+
+/*Process-local handle; the queue itself is in the arena*/
+struct LFShmQueue {
+    struct lfq_shm_header* hdr; /*this process's mapping of the arena*/
+    size_t size;
+    bool mapped; /*mapped by LFShmQueue_create()/attach(), so detach unmaps it*/
+    unsigned long long id; /*tells apart handles of this process for the per-thread record slots*/
+    atomic_uint releasing; /*threads giving a record back outside the registry lock; detach waits for them*/
+    struct LFShmQueue* registry_next;
+};
+
+size_t LFShmQueue_arena_size(size_t capacity, unsigned records); /*bytes for capacity items and records threads*/
+
+/*
+ * Lay out an empty queue in size bytes at mem (cache-line aligned, at most
+ * 4 GiB), with records hazard pointer records. Once per arena, before anyone opens it.
+ */
+int LFShmQueue_format(void* mem, size_t size, unsigned records);
+int LFShmQueue_open(struct LFShmQueue* me, void* mem, size_t size); /*the calling process maps mem itself*/
+
+/*Named arenas in /dev/shm: create fails if name exists, attach fails until it is formatted*/
+int LFShmQueue_create(struct LFShmQueue* me, const char* name, size_t size, unsigned records);
+int LFShmQueue_attach(struct LFShmQueue* me, const char* name);
+int LFShmQueue_unlink(const char* name);
+
+/*
+ * No thread of this process may use the handle any more: their records are
+ * released (their retired nodes stay for the next owner) and a mapping made by
+ * create/attach is unmapped.
+ */
+int LFShmQueue_detach(struct LFShmQueue* me);
+
+unsigned LFShmQueue_recover(struct LFShmQueue* me); /*records of dead processes recovered*/
+size_t LFShmQueue_capacity(struct LFShmQueue* me); /*items the queue holds when no node is retired*/
+
+lfq_err_t enqueueLF_shm(struct LFShmQueue* me, int data);
+lfq_err_t dequeueLF_shm(struct LFShmQueue* me, int* output);
+
+#endif
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include "baseline_queues.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Baselines use plain malloc()/free() per item, which is what a typical
+ * lock-based queue does; the point is to compare against the obvious
+ * alternatives, not against tuned ones.
+ */
+
+typedef struct bnode {
+    int data;
+    struct bnode* next;
+}bnode_t;
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*LFQueue*/
+
+static void* lfq_create(queue_attr_t* attr)
+{
+    struct LFQueue* q = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct LFQueue));
+    if (!q)
+    {
+        return NULL;
+    }
+    if (LFQueue_init(q, attr) != 0)
+    {
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+static void lfq_destroy(void* q)
+{
+    LFQueue_destroy(q);
+    free(q);
+}
+
+static lfq_err_t lfq_enqueue(void* q, int data)
+{
+    return enqueueLF(q, data);
+}
+
+static lfq_err_t lfq_dequeue(void* q, int* output)
+{
+    return dequeueLF(q, output);
+}
+
+static lfq_err_t lfq_dequeue_wait(void* q, int* output, int timeout_ms)
+{
+    return dequeueLF_wait(q, output, timeout_ms);
+}
+
+const bench_queue_ops_t lfq_queue_ops = {
+    .name = "lfq",
+    .create = lfq_create,
+    .destroy = lfq_destroy,
+    .enqueue = lfq_enqueue,
+    .dequeue = lfq_dequeue,
+    .dequeue_wait = lfq_dequeue_wait,
+    .thread_exit = LFQueue_cleanup_thread,
+};
+
+/*LFShardedQueue*/
+
+static unsigned g_shardedLanes = 4;
+
+void bench_queue_set_lanes(unsigned lanes)
+{
+    g_shardedLanes = lanes ? lanes : 1;
+}
+
+static void* sharded_create(queue_attr_t* attr)
+{
+    struct LFShardedQueue* q = malloc(sizeof(struct LFShardedQueue));
+    if (!q)
+    {
+        return NULL;
+    }
+    if (LFShardedQueue_init(q, g_shardedLanes, attr) != 0)
+    {
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+static void sharded_destroy(void* q)
+{
+    LFShardedQueue_destroy(q);
+    free(q);
+}
+
+static lfq_err_t sharded_enqueue(void* q, int data)
+{
+    return enqueueLF_sharded(q, data);
+}
+
+static lfq_err_t sharded_dequeue(void* q, int* output)
+{
+    return dequeueLF_sharded(q, output);
+}
+
+const bench_queue_ops_t sharded_queue_ops = {
+    .name = "sharded",
+    .create = sharded_create,
+    .destroy = sharded_destroy,
+    .enqueue = sharded_enqueue,
+    .dequeue = sharded_dequeue,
+    .dequeue_wait = NULL,
+    .thread_start = LFShardedQueue_set_home,
+    .thread_exit = LFQueue_cleanup_thread,
+};
+
+/*mutex + condition variable*/
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    bnode_t* head;
+    bnode_t* tail;
+    unsigned waiters;
+}mutex_queue_t;
+
+static void* mutex_create(queue_attr_t* attr)
+{
+    (void)attr;
+    mutex_queue_t* q = calloc(1, sizeof(mutex_queue_t));
+    if (!q)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->nonempty, NULL);
+    return q;
+}
+
+static void mutex_destroy(void* arg)
+{
+    mutex_queue_t* q = arg;
+    while (q->head)
+    {
+        bnode_t* n = q->head;
+        q->head = n->next;
+        free(n);
+    }
+    pthread_cond_destroy(&q->nonempty);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+static lfq_err_t mutex_enqueue(void* arg, int data)
+{
+    mutex_queue_t* q = arg;
+    bnode_t* n = malloc(sizeof(bnode_t));
+    if (!n)
+    {
+        return LFQ_ENOMEM;
+    }
+    n->data = data;
+    n->next = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail)
+    {
+        q->tail->next = n;
+    }
+    else
+    {
+        q->head = n;
+    }
+    q->tail = n;
+    bool wake = q->waiters > 0;
+    pthread_mutex_unlock(&q->lock);
+
+    if (wake)
+    {
+        pthread_cond_signal(&q->nonempty);
+    }
+    return LFQ_OK;
+}
+
+/*caller holds the lock*/
+static lfq_err_t mutex_take_locked(mutex_queue_t* q, int* output)
+{
+    bnode_t* n = q->head;
+    if (!n)
+    {
+        return LFQ_EEMPTY;
+    }
+    q->head = n->next;
+    if (!q->head)
+    {
+        q->tail = NULL;
+    }
+    *output = n->data;
+    free(n);
+    return LFQ_OK;
+}
+
+static lfq_err_t mutex_dequeue(void* arg, int* output)
+{
+    mutex_queue_t* q = arg;
+    pthread_mutex_lock(&q->lock);
+    lfq_err_t ret = mutex_take_locked(q, output);
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+static lfq_err_t mutex_dequeue_wait(void* arg, int* output, int timeout_ms)
+{
+    mutex_queue_t* q = arg;
+    struct timespec deadline;
+    if (timeout_ms > 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&q->lock);
+    lfq_err_t ret;
+    while ((ret = mutex_take_locked(q, output)) == LFQ_EEMPTY && timeout_ms != 0)
+    {
+        q->waiters++;
+        int rc = timeout_ms < 0 ? pthread_cond_wait(&q->nonempty, &q->lock)
+                                : pthread_cond_timedwait(&q->nonempty, &q->lock, &deadline);
+        q->waiters--;
+        if (rc != 0)
+        {
+            ret = mutex_take_locked(q, output);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+const bench_queue_ops_t mutex_queue_ops = {
+    .name = "mutex",
+    .create = mutex_create,
+    .destroy = mutex_destroy,
+    .enqueue = mutex_enqueue,
+    .dequeue = mutex_dequeue,
+    .dequeue_wait = mutex_dequeue_wait,
+    .thread_exit = NULL,
+};
+
+/*two-lock queue (Michael & Scott, PODC'96): dummy node, producers and consumers never share a lock*/
+
+typedef struct {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t head_lock;
+    bnode_t* head;
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t tail_lock;
+    bnode_t* tail;
+}twolock_queue_t;
+
+static void* twolock_create(queue_attr_t* attr)
+{
+    (void)attr;
+    twolock_queue_t* q = aligned_alloc(CACHE_LINE_SIZE, sizeof(twolock_queue_t));
+    bnode_t* dummy = malloc(sizeof(bnode_t));
+    if (!q || !dummy)
+    {
+        free(q);
+        free(dummy);
+        return NULL;
+    }
+    memset(q, 0, sizeof(*q));
+    dummy->next = NULL;
+    q->head = q->tail = dummy;
+    pthread_mutex_init(&q->head_lock, NULL);
+    pthread_mutex_init(&q->tail_lock, NULL);
+    return q;
+}
+
+static void twolock_destroy(void* arg)
+{
+    twolock_queue_t* q = arg;
+    while (q->head)
+    {
+        bnode_t* n = q->head;
+        q->head = n->next;
+        free(n);
+    }
+    pthread_mutex_destroy(&q->head_lock);
+    pthread_mutex_destroy(&q->tail_lock);
+    free(q);
+}
+
+static lfq_err_t twolock_enqueue(void* arg, int data)
+{
+    twolock_queue_t* q = arg;
+    bnode_t* n = malloc(sizeof(bnode_t));
+    if (!n)
+    {
+        return LFQ_ENOMEM;
+    }
+    n->data = data;
+    n->next = NULL;
+
+    pthread_mutex_lock(&q->tail_lock);
+    /*the only field both locks touch is the last node's next, hence the atomic store*/
+    __atomic_store_n(&q->tail->next, n, __ATOMIC_RELEASE);
+    q->tail = n;
+    pthread_mutex_unlock(&q->tail_lock);
+    return LFQ_OK;
+}
+
+static lfq_err_t twolock_dequeue(void* arg, int* output)
+{
+    twolock_queue_t* q = arg;
+
+    pthread_mutex_lock(&q->head_lock);
+    bnode_t* dummy = q->head;
+    bnode_t* first = __atomic_load_n(&dummy->next, __ATOMIC_ACQUIRE);
+    if (!first)
+    {
+        pthread_mutex_unlock(&q->head_lock);
+        return LFQ_EEMPTY;
+    }
+    *output = first->data;
+    q->head = first;
+    pthread_mutex_unlock(&q->head_lock);
+
+    free(dummy);
+    return LFQ_OK;
+}
+
+const bench_queue_ops_t twolock_queue_ops = {
+    .name = "twolock",
+    .create = twolock_create,
+    .destroy = twolock_destroy,
+    .enqueue = twolock_enqueue,
+    .dequeue = twolock_dequeue,
+    .dequeue_wait = NULL,
+    .thread_exit = NULL,
+};
+
+/*test-and-test-and-set spinlock around a plain list*/
+
+typedef struct {
+    alignas(CACHE_LINE_SIZE) atomic_bool locked;
+    bnode_t* head;
+    bnode_t* tail;
+}spinlock_queue_t;
+
+static void spin_lock(atomic_bool* lock)
+{
+    while (atomic_exchange_explicit(lock, true, memory_order_acquire))
+    {
+        while (atomic_load_explicit(lock, memory_order_relaxed))
+        {
+            cpu_relax();
+        }
+    }
+}
+
+static void spin_unlock(atomic_bool* lock)
+{
+    atomic_store_explicit(lock, false, memory_order_release);
+}
+
+static void* spinlock_create(queue_attr_t* attr)
+{
+    (void)attr;
+    spinlock_queue_t* q = aligned_alloc(CACHE_LINE_SIZE, sizeof(spinlock_queue_t));
+    if (!q)
+    {
+        return NULL;
+    }
+    memset(q, 0, sizeof(*q));
+    atomic_init(&q->locked, false);
+    return q;
+}
+
+static void spinlock_destroy(void* arg)
+{
+    spinlock_queue_t* q = arg;
+    while (q->head)
+    {
+        bnode_t* n = q->head;
+        q->head = n->next;
+        free(n);
+    }
+    free(q);
+}
+
+static lfq_err_t spinlock_enqueue(void* arg, int data)
+{
+    spinlock_queue_t* q = arg;
+    bnode_t* n = malloc(sizeof(bnode_t));
+    if (!n)
+    {
+        return LFQ_ENOMEM;
+    }
+    n->data = data;
+    n->next = NULL;
+
+    spin_lock(&q->locked);
+    if (q->tail)
+    {
+        q->tail->next = n;
+    }
+    else
+    {
+        q->head = n;
+    }
+    q->tail = n;
+    spin_unlock(&q->locked);
+    return LFQ_OK;
+}
+
+static lfq_err_t spinlock_dequeue(void* arg, int* output)
+{
+    spinlock_queue_t* q = arg;
+
+    spin_lock(&q->locked);
+    bnode_t* n = q->head;
+    if (!n)
+    {
+        spin_unlock(&q->locked);
+        return LFQ_EEMPTY;
+    }
+    q->head = n->next;
+    if (!q->head)
+    {
+        q->tail = NULL;
+    }
+    spin_unlock(&q->locked);
+
+    *output = n->data;
+    free(n);
+    return LFQ_OK;
+}
+
+const bench_queue_ops_t spinlock_queue_ops = {
+    .name = "spinlock",
+    .create = spinlock_create,
+    .destroy = spinlock_destroy,
+    .enqueue = spinlock_enqueue,
+    .dequeue = spinlock_dequeue,
+    .dequeue_wait = NULL,
+    .thread_exit = NULL,
+};
+
+static const bench_queue_ops_t* const g_benchQueues[] = {
+    &lfq_queue_ops,
+    &sharded_queue_ops,
+    &mutex_queue_ops,
+    &twolock_queue_ops,
+    &spinlock_queue_ops,
+};
+
+const bench_queue_ops_t* bench_queue_find(const char* name)
+{
+    for (size_t i = 0; i < sizeof(g_benchQueues) / sizeof(g_benchQueues[0]); i++)
+    {
+        if (strcmp(g_benchQueues[i]->name, name) == 0)
+        {
+            return g_benchQueues[i];
+        }
+    }
+    return NULL;
+}
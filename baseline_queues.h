@@ -0,0 +1,30 @@
+#ifndef _BASELINE_QUEUES_H_
+#define _BASELINE_QUEUES_H_
+
+#include "LFQueue.h"
+
+/*
+ * Common interface the benchmark drives, so the lock-free queue and the
+ * lock-based baselines below run the exact same workload.
+ */
+typedef struct bench_queue_ops {
+    const char* name;
+    void* (*create)(queue_attr_t* attr); /*attr is only used by "lfq"*/
+    void (*destroy)(void* q);
+    lfq_err_t (*enqueue)(void* q, int data);
+    lfq_err_t (*dequeue)(void* q, int* output);
+    lfq_err_t (*dequeue_wait)(void* q, int* output, int timeout_ms); /*NULL: poll dequeue instead*/
+    void (*thread_start)(unsigned index); /*NULL when the queue keeps no per-thread state*/
+    void (*thread_exit)(void);
+}bench_queue_ops_t;
+
+extern const bench_queue_ops_t lfq_queue_ops;      /*LFQueue, any backend/reclamation*/
+extern const bench_queue_ops_t sharded_queue_ops;  /*LFShardedQueue over LFQueue lanes*/
+extern const bench_queue_ops_t mutex_queue_ops;    /*single mutex + condition variable*/
+extern const bench_queue_ops_t twolock_queue_ops;  /*Michael-Scott two-lock queue*/
+extern const bench_queue_ops_t spinlock_queue_ops; /*single test-and-test-and-set spinlock*/
+
+const bench_queue_ops_t* bench_queue_find(const char* name); /*NULL if unknown*/
+void bench_queue_set_lanes(unsigned lanes); /*lane count of "sharded" queues created afterwards*/
+
+#endif
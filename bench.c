@@ -0,0 +1,1158 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "LFQueue.h"
+#include "baseline_queues.h"
+
+/*
+ * Throughput/latency benchmark for LFQueue.
+ *
+ * Built without sanitizers (see `make bench`). For every queue type and
+ * producer/consumer combination in the sweep a queue is created, a warmup phase is run and then
+ * a timed phase. Every Nth operation of each thread is timed individually and
+ * the samples are merged into latency percentiles.
+ */
+
+#define BENCH_MAX_THREADS (256)
+#define BENCH_MAX_SWEEP (32)
+#define BENCH_FLUSH_EVERY (1024) /*consumer count flush interval*/
+
+typedef enum
+{
+    FORMAT_CSV,
+    FORMAT_JSON
+} bench_format_t;
+
+typedef struct
+{
+    unsigned producers[BENCH_MAX_SWEEP];
+    unsigned num_producers;
+    unsigned consumers[BENCH_MAX_SWEEP];
+    unsigned num_consumers;
+    bool paired; /*-t: producers[i] == consumers[i] instead of the cartesian product*/
+    const bench_queue_ops_t* queues[BENCH_MAX_SWEEP];
+    unsigned num_queues;
+    lfq_backoff_t backoffs[BENCH_MAX_SWEEP];
+    unsigned num_backoffs;
+    unsigned long items;
+    unsigned long warmup_items;
+    unsigned repetitions;
+    unsigned sample_every;
+    bool pin;
+    bool blocking;
+    bool eventfd; /*lfq consumers sleep in poll() on LFQueue_fd()*/
+    bench_format_t format;
+    queue_attr_t attr;
+    unsigned forkjoin_depth; /*0: producer/consumer mode*/
+} bench_config_t;
+
+typedef struct
+{
+    uint64_t* samples;
+    size_t count;
+    size_t capacity;
+} latency_log_t;
+
+typedef struct bench_run bench_run_t;
+
+typedef struct
+{
+    size_t cas_failures;
+    size_t backoff_spins;
+    size_t steals;
+    size_t syscalls; /*eventfd reads/writes plus consumer poll() calls*/
+    lfq_scan_stats_t scan; /*Scan() calls and latency, process-wide (the makefile builds bench with LFQ_SCAN_TIMING)*/
+} contention_t;
+
+typedef struct
+{
+    bench_run_t* run;
+    unsigned index;
+    bool producer;
+    latency_log_t log;
+    uint64_t phase_start; /*taken by the worker itself, see bench_run_once()*/
+    uint64_t phase_end;
+} bench_thread_t;
+
+struct bench_run
+{
+    const bench_config_t* config;
+    const bench_queue_ops_t* ops;
+    void* queue;
+    lfq_backoff_t backoff;
+    contention_t contention; /*timed phase only, LFQueue only*/
+    unsigned producers;
+    unsigned consumers;
+    unsigned long phase_items[2]; /*warmup, timed*/
+    pthread_barrier_t barrier;
+    atomic_ulong consumed;
+    atomic_ulong polls;
+    bench_thread_t threads[BENCH_MAX_THREADS];
+};
+
+typedef struct
+{
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} percentiles_t;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void log_record(latency_log_t* log, uint64_t ns)
+{
+    if (log->count < log->capacity)
+    {
+        log->samples[log->count++] = ns;
+    }
+}
+
+static void bench_produce(bench_thread_t* self, unsigned long items, bool record)
+{
+    bench_run_t* run = self->run;
+    unsigned sample_every = run->config->sample_every;
+
+    for (unsigned long i = 0; i < items; i++)
+    {
+        bool timed = record && (i % sample_every) == 0;
+        uint64_t start = timed ? now_ns() : 0;
+
+        while (run->ops->enqueue(run->queue, (int)i) == LFQ_EFULL)
+        {
+            /*bounded backend: wait for consumers to make room*/
+        }
+
+        if (timed)
+        {
+            log_record(&self->log, now_ns() - start);
+        }
+    }
+}
+
+static void bench_consume(bench_thread_t* self, unsigned long total, bool record)
+{
+    bench_run_t* run = self->run;
+    unsigned sample_every = run->config->sample_every;
+    bool blocking = run->config->blocking && run->ops->dequeue_wait;
+    int fd = (run->config->eventfd && run->ops == &lfq_queue_ops) ? LFQueue_fd(run->queue) : -1;
+    unsigned long polls = 0;
+    unsigned long local = 0;
+    unsigned long seen = 0;
+
+    while (1)
+    {
+        int value;
+        bool timed = record && (seen % sample_every) == 0;
+        uint64_t start = timed ? now_ns() : 0;
+        lfq_err_t ret = blocking ? run->ops->dequeue_wait(run->queue, &value, 1)
+                                 : run->ops->dequeue(run->queue, &value);
+        if (ret == LFQ_OK)
+        {
+            if (timed)
+            {
+                log_record(&self->log, now_ns() - start);
+            }
+            seen++;
+            if (++local == BENCH_FLUSH_EVERY)
+            {
+                atomic_fetch_add_explicit(&run->consumed, local, memory_order_relaxed);
+                local = 0;
+            }
+            continue;
+        }
+
+        if (local)
+        {
+            atomic_fetch_add_explicit(&run->consumed, local, memory_order_relaxed);
+            local = 0;
+        }
+        if (atomic_load_explicit(&run->consumed, memory_order_relaxed) >= total)
+        {
+            break;
+        }
+
+        if (fd >= 0)
+        {
+            /*the timeout only matters once the last item has gone to another consumer*/
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            poll(&pfd, 1, 1);
+            polls++;
+        }
+    }
+    atomic_fetch_add_explicit(&run->polls, polls, memory_order_relaxed);
+}
+
+static void* bench_thread(void* arg)
+{
+    bench_thread_t* self = arg;
+    bench_run_t* run = self->run;
+
+    if (run->ops->thread_start)
+    {
+        /*producer i and consumer i share a home lane*/
+        run->ops->thread_start(self->index);
+    }
+
+    for (int phase = 0; phase < 2; phase++)
+    {
+        unsigned long total = run->phase_items[phase];
+        bool record = (phase == 1);
+
+        pthread_barrier_wait(&run->barrier);
+        self->phase_start = now_ns();
+        if (self->producer)
+        {
+            /*spread the remainder over the first producers*/
+            unsigned long share = total / run->producers + (self->index < total % run->producers ? 1 : 0);
+            bench_produce(self, share, record);
+        }
+        else
+        {
+            bench_consume(self, total, record);
+        }
+        self->phase_end = now_ns();
+        pthread_barrier_wait(&run->barrier);
+    }
+
+    if (run->ops->thread_exit)
+    {
+        run->ops->thread_exit();
+    }
+
+    return NULL;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile_at(const uint64_t* sorted, size_t count, double p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    size_t rank = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[rank];
+}
+
+static percentiles_t merge_percentiles(bench_run_t* run, bool producers)
+{
+    percentiles_t result = {0};
+    size_t total = 0;
+    for (unsigned i = 0; i < run->producers + run->consumers; i++)
+    {
+        if (run->threads[i].producer == producers)
+        {
+            total += run->threads[i].log.count;
+        }
+    }
+    if (total == 0)
+    {
+        return result;
+    }
+
+    uint64_t* merged = malloc(total * sizeof(uint64_t));
+    if (!merged)
+    {
+        return result;
+    }
+    size_t pos = 0;
+    for (unsigned i = 0; i < run->producers + run->consumers; i++)
+    {
+        bench_thread_t* t = &run->threads[i];
+        if (t->producer == producers)
+        {
+            memcpy(merged + pos, t->log.samples, t->log.count * sizeof(uint64_t));
+            pos += t->log.count;
+        }
+    }
+    qsort(merged, total, sizeof(uint64_t), compare_u64);
+
+    result.p50 = percentile_at(merged, total, 0.50);
+    result.p90 = percentile_at(merged, total, 0.90);
+    result.p99 = percentile_at(merged, total, 0.99);
+    result.p999 = percentile_at(merged, total, 0.999);
+    result.max = merged[total - 1];
+    free(merged);
+
+    return result;
+}
+
+static bool uses_lfqueue(const bench_queue_ops_t* ops)
+{
+    return ops == &lfq_queue_ops || ops == &sharded_queue_ops;
+}
+
+static const char* backend_name(const bench_queue_ops_t* ops, const queue_attr_t* attr)
+{
+    if (!uses_lfqueue(ops))
+    {
+        return "list";
+    }
+    return attr->backend == LFQ_BACKEND_RING ? "ring" : attr->backend == LFQ_BACKEND_SEGMENT ? "segment" : "list";
+}
+
+static const char* reclaim_name(const bench_queue_ops_t* ops, const queue_attr_t* attr)
+{
+    if (!uses_lfqueue(ops) || attr->backend == LFQ_BACKEND_RING)
+    {
+        return "none";
+    }
+    if (attr->backend != LFQ_BACKEND_SEGMENT && attr->reclaim == LFQ_RECLAIM_EBR)
+    {
+        return "ebr";
+    }
+    return attr->background_reclaim ? "hp-bg" : "hp";
+}
+
+static const char* const g_backoffNames[] = {
+    [LFQ_BACKOFF_NONE] = "none",
+    [LFQ_BACKOFF_EXP] = "exp",
+    [LFQ_BACKOFF_RANDOM] = "rand",
+};
+
+static const char* backoff_name(const bench_run_t* run)
+{
+    if (!uses_lfqueue(run->ops) || run->config->attr.backend == LFQ_BACKEND_RING)
+    {
+        return "none";
+    }
+    return g_backoffNames[run->backoff];
+}
+
+static void print_header(const bench_config_t* config)
+{
+    if (config->format == FORMAT_CSV)
+    {
+        printf("queue,backend,reclaim,backoff,producers,consumers,items,rep,seconds,items_per_sec,ops_per_sec,"
+               "cas_failures,backoff_spins,steals,syscalls_per_mmsg,scans,scan_avg_ns,scan_max_ns,"
+               "enq_p50_ns,enq_p90_ns,enq_p99_ns,enq_p999_ns,enq_max_ns,"
+               "deq_p50_ns,deq_p90_ns,deq_p99_ns,deq_p999_ns,deq_max_ns\n");
+    }
+    else
+    {
+        printf("[\n");
+    }
+}
+
+static void print_result(const bench_config_t* config, const bench_run_t* run, unsigned rep, double seconds,
+                         const percentiles_t* enq, const percentiles_t* deq, bool first)
+{
+    unsigned long items = run->phase_items[1];
+    double items_per_sec = seconds > 0 ? (double)items / seconds : 0;
+    double syscalls_per_mmsg = items ? (double)run->contention.syscalls * 1e6 / (double)items : 0;
+    const lfq_scan_stats_t* scan = &run->contention.scan;
+    unsigned long long scan_avg_ns = scan->scans ? scan->total_ns / scan->scans : 0;
+
+    if (config->format == FORMAT_CSV)
+    {
+        printf("%s,%s,%s,%s,%u,%u,%lu,%u,%.6f,%.0f,%.0f,%zu,%zu,%zu,%.1f,%zu,%llu,%llu,"
+               "%llu,%llu,%llu,%llu,%llu,"
+               "%llu,%llu,%llu,%llu,%llu\n",
+               run->ops->name, backend_name(run->ops, &config->attr), reclaim_name(run->ops, &config->attr),
+               backoff_name(run), run->producers, run->consumers, items, rep,
+               seconds, items_per_sec, 2 * items_per_sec, run->contention.cas_failures, run->contention.backoff_spins,
+               run->contention.steals, syscalls_per_mmsg, scan->scans, scan_avg_ns, scan->max_ns,
+               (unsigned long long)enq->p50, (unsigned long long)enq->p90, (unsigned long long)enq->p99,
+               (unsigned long long)enq->p999, (unsigned long long)enq->max,
+               (unsigned long long)deq->p50, (unsigned long long)deq->p90, (unsigned long long)deq->p99,
+               (unsigned long long)deq->p999, (unsigned long long)deq->max);
+    }
+    else
+    {
+        printf("%s  {\"queue\": \"%s\", \"backend\": \"%s\", \"reclaim\": \"%s\", \"backoff\": \"%s\", "
+               "\"producers\": %u, \"consumers\": %u, "
+               "\"items\": %lu, \"rep\": %u, \"seconds\": %.6f, \"items_per_sec\": %.0f, \"ops_per_sec\": %.0f, "
+               "\"cas_failures\": %zu, \"backoff_spins\": %zu, \"steals\": %zu, \"syscalls_per_mmsg\": %.1f, "
+               "\"scans\": %zu, \"scan_avg_ns\": %llu, \"scan_max_ns\": %llu, "
+               "\"enqueue_ns\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}, "
+               "\"dequeue_ns\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+               first ? "" : ",\n", run->ops->name,
+               backend_name(run->ops, &config->attr), reclaim_name(run->ops, &config->attr), backoff_name(run),
+               run->producers, run->consumers, items, rep,
+               seconds, items_per_sec, 2 * items_per_sec, run->contention.cas_failures, run->contention.backoff_spins,
+               run->contention.steals, syscalls_per_mmsg, scan->scans, scan_avg_ns, scan->max_ns,
+               (unsigned long long)enq->p50, (unsigned long long)enq->p90, (unsigned long long)enq->p99,
+               (unsigned long long)enq->p999, (unsigned long long)enq->max,
+               (unsigned long long)deq->p50, (unsigned long long)deq->p90, (unsigned long long)deq->p99,
+               (unsigned long long)deq->p999, (unsigned long long)deq->max);
+    }
+    fflush(stdout);
+}
+
+static void print_footer(const bench_config_t* config)
+{
+    if (config->format == FORMAT_JSON)
+    {
+        printf("\n]\n");
+    }
+}
+
+static void read_contention(const bench_run_t* run, contention_t* out)
+{
+    memset(out, 0, sizeof(*out));
+    out->syscalls = atomic_load_explicit(&run->polls, memory_order_relaxed);
+    if (!uses_lfqueue(run->ops))
+    {
+        return;
+    }
+
+    /*the lanes of a sharded queue share one domain, so lane 0 reports all of them*/
+    struct LFQueue* queue = run->queue;
+    if (run->ops == &sharded_queue_ops)
+    {
+        struct LFShardedQueue* sharded = run->queue;
+        lfq_sharded_stats_t sharded_stats;
+        LFShardedQueue_get_stats(sharded, &sharded_stats);
+        out->steals = sharded_stats.steals;
+        queue = &sharded->lanes[0];
+    }
+
+    lfq_stats_t stats;
+    if (LFQueue_get_stats(queue, &stats) == 0)
+    {
+        out->cas_failures = stats.enqueue_cas_failures + stats.dequeue_cas_failures;
+        out->backoff_spins = stats.backoff_spins;
+        out->syscalls += stats.fd_writes + stats.fd_reads;
+    }
+}
+
+static int bench_run_once(const bench_config_t* config, const bench_queue_ops_t* ops, lfq_backoff_t backoff,
+                          unsigned producers, unsigned consumers, unsigned rep, bool first)
+{
+    bench_run_t* run = calloc(1, sizeof(bench_run_t));
+    if (!run)
+    {
+        fprintf(stderr, "bench: out of memory\n");
+        return -1;
+    }
+    run->config = config;
+    run->ops = ops;
+    run->backoff = backoff;
+    run->producers = producers;
+    run->consumers = consumers;
+    run->phase_items[0] = config->warmup_items;
+    run->phase_items[1] = config->items;
+    atomic_init(&run->consumed, 0);
+    atomic_init(&run->polls, 0);
+
+    queue_attr_t attr = config->attr;
+    attr.backoff = backoff;
+    run->queue = ops->create(&attr);
+    if (!run->queue)
+    {
+        fprintf(stderr, "bench: failed to create a '%s' queue\n", ops->name);
+        free(run);
+        return -1;
+    }
+
+    unsigned num_threads = producers + consumers;
+    pthread_barrier_init(&run->barrier, NULL, num_threads + 1);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+    {
+        ncpu = 1;
+    }
+
+    pthread_t tids[BENCH_MAX_THREADS];
+    int ret = 0;
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        bench_thread_t* t = &run->threads[i];
+        t->run = run;
+        t->producer = i < producers;
+        t->index = t->producer ? i : i - producers;
+
+        /*one sample slot per Nth op; consumers may see any share, so size them for all items*/
+        unsigned long share = t->producer ? config->items / producers + 1 : config->items;
+        t->log.capacity = share / config->sample_every + 1;
+        t->log.samples = malloc(t->log.capacity * sizeof(uint64_t));
+        if (!t->log.samples)
+        {
+            t->log.capacity = 0;
+        }
+
+        pthread_attr_t tattr;
+        pthread_attr_init(&tattr);
+        if (config->pin)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % (unsigned long)ncpu, &set);
+            pthread_attr_setaffinity_np(&tattr, sizeof(set), &set);
+        }
+        if (pthread_create(&tids[i], &tattr, bench_thread, t) != 0)
+        {
+            /*the barrier would never trip, there is no clean way back from here*/
+            fprintf(stderr, "bench: pthread_create() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_attr_destroy(&tattr);
+    }
+
+    double seconds = 0;
+    contention_t before = {0};
+    for (int phase = 0; phase < 2; phase++)
+    {
+        /*
+         * The workers read the clock themselves: once threads outnumber cpus
+         * they can run the whole phase before this thread is scheduled again.
+         */
+        pthread_barrier_wait(&run->barrier);
+        pthread_barrier_wait(&run->barrier);
+        uint64_t start = UINT64_MAX;
+        uint64_t end = 0;
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            if (run->threads[i].phase_start < start)
+            {
+                start = run->threads[i].phase_start;
+            }
+            if (run->threads[i].phase_end > end)
+            {
+                end = run->threads[i].phase_end;
+            }
+        }
+        seconds = (double)(end - start) / 1e9;
+        atomic_store(&run->consumed, 0);
+
+        /*counters are cumulative, report the timed phase only*/
+        contention_t now;
+        read_contention(run, &now);
+        run->contention.cas_failures = now.cas_failures - before.cas_failures;
+        run->contention.backoff_spins = now.backoff_spins - before.backoff_spins;
+        run->contention.steals = now.steals - before.steals;
+        run->contention.syscalls = now.syscalls - before.syscalls;
+        before = now;
+
+        /*the scan counters cannot be subtracted (max), so they restart with the timed phase*/
+        LFQueue_get_scan_stats(&run->contention.scan);
+        LFQueue_reset_scan_stats();
+    }
+
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    percentiles_t enq = merge_percentiles(run, true);
+    percentiles_t deq = merge_percentiles(run, false);
+    print_result(config, run, rep, seconds, &enq, &deq, first);
+
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        free(run->threads[i].log.samples);
+    }
+    pthread_barrier_destroy(&run->barrier);
+    ops->destroy(run->queue);
+    free(run);
+
+    return ret;
+}
+
+/*
+ * Fork-join mode (-J DEPTH): every worker seeds one root task, and a task of
+ * depth d > 0 spawns two tasks of depth d - 1, as a recursive divide and
+ * conquer would. "deque" gives each worker an LFDeque it pushes to and pops
+ * from, stealing from a random victim when it runs dry; the queues from -Q
+ * run the same tree through one shared queue.
+ */
+typedef struct forkjoin_run forkjoin_run_t;
+
+typedef struct
+{
+    forkjoin_run_t* run;
+    unsigned index;
+    uint32_t seed; /*victim selection*/
+    size_t steals;
+} forkjoin_thread_t;
+
+struct forkjoin_run
+{
+    const bench_queue_ops_t* ops; /*NULL: per-worker deques*/
+    void* queue;
+    struct LFDeque* deques;
+    unsigned workers;
+    unsigned depth;
+    unsigned long total_tasks;
+    pthread_barrier_t barrier;
+    atomic_ulong completed;
+    forkjoin_thread_t threads[BENCH_MAX_THREADS];
+};
+
+static void forkjoin_push(forkjoin_thread_t* self, int task)
+{
+    forkjoin_run_t* run = self->run;
+    if (!run->ops)
+    {
+        if (LFDeque_push(&run->deques[self->index], task) != LFQ_OK)
+        {
+            fprintf(stderr, "bench: LFDeque_push() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    while (run->ops->enqueue(run->queue, task) == LFQ_EFULL)
+    {
+        /*bounded backend: wait for other workers to make room*/
+    }
+}
+
+static bool forkjoin_take(forkjoin_thread_t* self, int* task)
+{
+    forkjoin_run_t* run = self->run;
+    if (run->ops)
+    {
+        return run->ops->dequeue(run->queue, task) == LFQ_OK;
+    }
+
+    if (LFDeque_pop(&run->deques[self->index], task) == LFQ_OK)
+    {
+        return true;
+    }
+    if (run->workers < 2)
+    {
+        return false;
+    }
+
+    self->seed ^= self->seed << 13;
+    self->seed ^= self->seed >> 17;
+    self->seed ^= self->seed << 5;
+    unsigned victim = (self->index + 1 + self->seed % (run->workers - 1)) % run->workers;
+    if (LFDeque_steal(&run->deques[victim], task) == LFQ_OK)
+    {
+        self->steals++;
+        return true;
+    }
+    return false;
+}
+
+static void* forkjoin_thread(void* arg)
+{
+    forkjoin_thread_t* self = arg;
+    forkjoin_run_t* run = self->run;
+    unsigned long local = 0;
+
+    if (run->ops && run->ops->thread_start)
+    {
+        run->ops->thread_start(self->index);
+    }
+
+    pthread_barrier_wait(&run->barrier);
+    forkjoin_push(self, (int)run->depth);
+    while (1)
+    {
+        int task;
+        if (forkjoin_take(self, &task))
+        {
+            if (task > 0)
+            {
+                forkjoin_push(self, task - 1);
+                forkjoin_push(self, task - 1);
+            }
+            if (++local == BENCH_FLUSH_EVERY)
+            {
+                atomic_fetch_add_explicit(&run->completed, local, memory_order_relaxed);
+                local = 0;
+            }
+            continue;
+        }
+
+        if (local)
+        {
+            atomic_fetch_add_explicit(&run->completed, local, memory_order_relaxed);
+            local = 0;
+        }
+        if (atomic_load_explicit(&run->completed, memory_order_relaxed) >= run->total_tasks)
+        {
+            break;
+        }
+    }
+
+    if (run->ops && run->ops->thread_exit)
+    {
+        run->ops->thread_exit();
+    }
+    else if (!run->ops)
+    {
+        LFQueue_cleanup_thread();
+    }
+    return NULL;
+}
+
+static void print_forkjoin_header(const bench_config_t* config)
+{
+    if (config->format == FORMAT_CSV)
+    {
+        printf("queue,workers,depth,tasks,rep,seconds,tasks_per_sec,steals\n");
+    }
+    else
+    {
+        printf("[\n");
+    }
+}
+
+static int forkjoin_run_once(const bench_config_t* config, const bench_queue_ops_t* ops, unsigned workers,
+                             unsigned rep, bool first)
+{
+    forkjoin_run_t* run = calloc(1, sizeof(forkjoin_run_t));
+    if (!run)
+    {
+        fprintf(stderr, "bench: out of memory\n");
+        return -1;
+    }
+    run->ops = ops;
+    run->workers = workers;
+    run->depth = config->forkjoin_depth;
+    run->total_tasks = (unsigned long)workers * ((2UL << run->depth) - 1);
+    atomic_init(&run->completed, 0);
+
+    if (ops)
+    {
+        queue_attr_t attr = config->attr;
+        run->queue = ops->create(&attr);
+        if (!run->queue)
+        {
+            fprintf(stderr, "bench: failed to create a '%s' queue\n", ops->name);
+            free(run);
+            return -1;
+        }
+    }
+    else
+    {
+        /*the workers' deques share one domain, so a thief holds one record however many it robs*/
+        run->deques = aligned_alloc(CACHE_LINE_SIZE, workers * sizeof(struct LFDeque));
+        hp_domain_t* domain = hp_domain_create();
+        if (!run->deques || !domain)
+        {
+            fprintf(stderr, "bench: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned i = 0; i < workers; i++)
+        {
+            if (LFDeque_init(&run->deques[i], 256, domain) != 0)
+            {
+                fprintf(stderr, "bench: LFDeque_init() failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    pthread_barrier_init(&run->barrier, NULL, workers + 1);
+    pthread_t tids[BENCH_MAX_THREADS];
+    for (unsigned i = 0; i < workers; i++)
+    {
+        forkjoin_thread_t* t = &run->threads[i];
+        t->run = run;
+        t->index = i;
+        t->seed = 2463534242u + i * 0x9E3779B9u;
+        if (pthread_create(&tids[i], NULL, forkjoin_thread, t) != 0)
+        {
+            fprintf(stderr, "bench: pthread_create() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /*read the clock first: on few cpus the workers can run the whole tree before this thread wakes up*/
+    uint64_t start = now_ns();
+    pthread_barrier_wait(&run->barrier);
+    for (unsigned i = 0; i < workers; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    size_t steals = 0;
+    for (unsigned i = 0; i < workers; i++)
+    {
+        steals += run->threads[i].steals;
+    }
+    const char* name = ops ? ops->name : "deque";
+    double tasks_per_sec = seconds > 0 ? (double)run->total_tasks / seconds : 0;
+    if (config->format == FORMAT_CSV)
+    {
+        printf("%s,%u,%u,%lu,%u,%.6f,%.0f,%zu\n", name, workers, run->depth, run->total_tasks, rep, seconds,
+               tasks_per_sec, steals);
+    }
+    else
+    {
+        printf("%s  {\"queue\": \"%s\", \"workers\": %u, \"depth\": %u, \"tasks\": %lu, \"rep\": %u, "
+               "\"seconds\": %.6f, \"tasks_per_sec\": %.0f, \"steals\": %zu}",
+               first ? "" : ",\n", name, workers, run->depth, run->total_tasks, rep, seconds, tasks_per_sec, steals);
+    }
+    fflush(stdout);
+
+    pthread_barrier_destroy(&run->barrier);
+    if (ops)
+    {
+        ops->destroy(run->queue);
+    }
+    else
+    {
+        hp_domain_t* domain = run->deques[0].domain;
+        for (unsigned i = 0; i < workers; i++)
+        {
+            LFDeque_destroy(&run->deques[i]);
+        }
+        hp_domain_destroy(domain);
+        free(run->deques);
+    }
+    free(run);
+
+    return 0;
+}
+
+static int parse_list(const char* text, unsigned* out, unsigned* count)
+{
+    char* copy = strdup(text);
+    if (!copy)
+    {
+        return -1;
+    }
+
+    *count = 0;
+    char* save = NULL;
+    for (char* tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char* end;
+        unsigned long v = strtoul(tok, &end, 10);
+        if (*end != '\0' || v == 0 || v > BENCH_MAX_THREADS / 2 || *count == BENCH_MAX_SWEEP)
+        {
+            free(copy);
+            return -1;
+        }
+        out[(*count)++] = (unsigned)v;
+    }
+    free(copy);
+
+    return *count ? 0 : -1;
+}
+
+static int parse_queues(const char* text, const bench_queue_ops_t** out, unsigned* count)
+{
+    char* copy = strdup(text);
+    if (!copy)
+    {
+        return -1;
+    }
+
+    *count = 0;
+    char* save = NULL;
+    for (char* tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        const bench_queue_ops_t* ops = bench_queue_find(tok);
+        if (!ops || *count == BENCH_MAX_SWEEP)
+        {
+            free(copy);
+            return -1;
+        }
+        out[(*count)++] = ops;
+    }
+    free(copy);
+
+    return *count ? 0 : -1;
+}
+
+static int parse_backoffs(const char* text, lfq_backoff_t* out, unsigned* count)
+{
+    char* copy = strdup(text);
+    if (!copy)
+    {
+        return -1;
+    }
+
+    *count = 0;
+    char* save = NULL;
+    for (char* tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        unsigned b = 0;
+        while (b < sizeof(g_backoffNames) / sizeof(g_backoffNames[0]) && strcmp(g_backoffNames[b], tok) != 0)
+        {
+            b++;
+        }
+        if (b == sizeof(g_backoffNames) / sizeof(g_backoffNames[0]) || *count == BENCH_MAX_SWEEP)
+        {
+            free(copy);
+            return -1;
+        }
+        out[(*count)++] = (lfq_backoff_t)b;
+    }
+    free(copy);
+
+    return *count ? 0 : -1;
+}
+
+static void print_usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -Q LIST   queues to compare: lfq, sharded, mutex, twolock, spinlock (default lfq)\n"
+            "  -L N      lanes of the sharded queue (default 4)\n"
+            "  -p LIST   producer counts to sweep, comma separated (default 1,2,4)\n"
+            "  -c LIST   consumer counts to sweep, comma separated (default 1,2,4)\n"
+            "  -t LIST   N producers and N consumers for each N, instead of -p x -c\n"
+            "  -B LIST   LFQueue CAS backoff policies to sweep: none, exp, rand (default none)\n"
+            "  -n N      items per timed phase (default 1000000)\n"
+            "  -w N      items per warmup phase (default 100000)\n"
+            "  -r N      repetitions per combination (default 3)\n"
+            "  -s N      time every Nth operation per thread (default 64)\n"
+            "  -b NAME   backend: list, ring or segment (default list)\n"
+            "  -q N      ring capacity (default 65536)\n"
+            "  -M N      bound lfq to N items with the sharded size counters, producers retry on full (default 0: off)\n"
+            "  -R NAME   reclamation for the list backend: hp or ebr (default hp)\n"
+            "  -G        hazard pointers: hand full retired lists to a background reclaimer thread\n"
+            "  -W        consumers block (dequeueLF_wait(), condvar for mutex) instead of polling\n"
+            "  -E        lfq consumers sleep in poll() on the queue's eventfd (LFQueue_fd()) when it runs empty\n"
+            "  -a        pin thread i to cpu i %% ncpu\n"
+            "  -f NAME   output format: csv or json (default csv)\n"
+            "  -J DEPTH  fork-join mode: binary task trees of DEPTH per worker on per-worker work-stealing\n"
+            "            deques, then on each -Q queue shared by all workers; -t/-p give the worker counts\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_config_t config = {
+        .producers = {1, 2, 4},
+        .num_producers = 3,
+        .consumers = {1, 2, 4},
+        .num_consumers = 3,
+        .queues = {&lfq_queue_ops},
+        .num_queues = 1,
+        .backoffs = {LFQ_BACKOFF_NONE},
+        .num_backoffs = 1,
+        .items = 1000000,
+        .warmup_items = 100000,
+        .repetitions = 3,
+        .sample_every = 64,
+        .format = FORMAT_CSV,
+    };
+    queue_attr_init(&config.attr);
+    config.attr.capacity = 65536;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "Q:L:B:t:p:c:n:w:r:s:b:q:M:R:GWEaf:J:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'Q':
+            if (parse_queues(optarg, config.queues, &config.num_queues) != 0)
+            {
+                fprintf(stderr, "bench: invalid queue list '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            bench_queue_set_lanes((unsigned)strtoul(optarg, NULL, 10));
+            break;
+        case 'B':
+            if (parse_backoffs(optarg, config.backoffs, &config.num_backoffs) != 0)
+            {
+                fprintf(stderr, "bench: invalid backoff list '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parse_list(optarg, config.producers, &config.num_producers) != 0)
+            {
+                fprintf(stderr, "bench: invalid thread list '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            memcpy(config.consumers, config.producers, sizeof(config.consumers));
+            config.num_consumers = config.num_producers;
+            config.paired = true;
+            break;
+        case 'p':
+            if (parse_list(optarg, config.producers, &config.num_producers) != 0)
+            {
+                fprintf(stderr, "bench: invalid producer list '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            config.paired = false;
+            break;
+        case 'c':
+            if (parse_list(optarg, config.consumers, &config.num_consumers) != 0)
+            {
+                fprintf(stderr, "bench: invalid consumer list '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            config.paired = false;
+            break;
+        case 'n':
+            config.items = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            config.warmup_items = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            config.repetitions = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            config.sample_every = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            if (strcmp(optarg, "list") == 0)
+            {
+                config.attr.backend = LFQ_BACKEND_LIST;
+            }
+            else if (strcmp(optarg, "ring") == 0)
+            {
+                config.attr.backend = LFQ_BACKEND_RING;
+            }
+            else if (strcmp(optarg, "segment") == 0)
+            {
+                config.attr.backend = LFQ_BACKEND_SEGMENT;
+            }
+            else
+            {
+                fprintf(stderr, "bench: unknown backend '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'q':
+            config.attr.capacity = strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            config.attr.max_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            if (strcmp(optarg, "hp") == 0)
+            {
+                config.attr.reclaim = LFQ_RECLAIM_HP;
+            }
+            else if (strcmp(optarg, "ebr") == 0)
+            {
+                config.attr.reclaim = LFQ_RECLAIM_EBR;
+            }
+            else
+            {
+                fprintf(stderr, "bench: unknown reclamation scheme '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'G':
+            config.attr.background_reclaim = true;
+            break;
+        case 'W':
+            config.blocking = true;
+            break;
+        case 'E':
+            config.eventfd = true;
+            config.attr.eventfd = true;
+            break;
+        case 'a':
+            config.pin = true;
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0)
+            {
+                config.format = FORMAT_CSV;
+            }
+            else if (strcmp(optarg, "json") == 0)
+            {
+                config.format = FORMAT_JSON;
+            }
+            else
+            {
+                fprintf(stderr, "bench: unknown format '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'J':
+            config.forkjoin_depth = (unsigned)strtoul(optarg, NULL, 10);
+            if (config.forkjoin_depth == 0 || config.forkjoin_depth > 30)
+            {
+                fprintf(stderr, "bench: fork-join depth must be within 1..30\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (config.items == 0 || config.repetitions == 0 || config.sample_every == 0)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (config.forkjoin_depth)
+    {
+        print_forkjoin_header(&config);
+        bool first = true;
+        for (unsigned q = 0; q <= config.num_queues; q++)
+        {
+            const bench_queue_ops_t* ops = q == 0 ? NULL : config.queues[q - 1];
+            for (unsigned w = 0; w < config.num_producers; w++)
+            {
+                for (unsigned rep = 0; rep < config.repetitions; rep++)
+                {
+                    if (forkjoin_run_once(&config, ops, config.producers[w], rep, first) != 0)
+                    {
+                        return EXIT_FAILURE;
+                    }
+                    first = false;
+                }
+            }
+        }
+        print_footer(&config);
+        return EXIT_SUCCESS;
+    }
+
+    print_header(&config);
+    bool first = true;
+    for (unsigned q = 0; q < config.num_queues; q++)
+    {
+        /*backoff is an LFQueue attribute, the baselines run once*/
+        unsigned num_backoffs = uses_lfqueue(config.queues[q]) ? config.num_backoffs : 1;
+        for (unsigned b = 0; b < num_backoffs; b++)
+        {
+            for (unsigned p = 0; p < config.num_producers; p++)
+            {
+                for (unsigned c = 0; c < config.num_consumers; c++)
+                {
+                    if (config.paired && c != p)
+                    {
+                        continue;
+                    }
+                    for (unsigned rep = 0; rep < config.repetitions; rep++)
+                    {
+                        if (bench_run_once(&config, config.queues[q], config.backoffs[b], config.producers[p],
+                                           config.consumers[c], rep, first) != 0)
+                        {
+                            return EXIT_FAILURE;
+                        }
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+    print_footer(&config);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,286 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LFQueue.hpp"
+
+/*
+ * Tests for the lfq::queue<T> wrapper. Built with ThreadSanitizer like main.c;
+ * no thread calls LFQueue_cleanup_thread(), the wrapper releases the records.
+ */
+
+static void fail(const char* what)
+{
+    printf("FAILED\n");
+    printf("%s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+/*move-only payload: producer id and sequence in one heap object*/
+struct message
+{
+    unsigned producer;
+    unsigned long seq;
+};
+
+static int move_only_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    printf("Typed queue test with std::unique_ptr items, %u producer(s)/%u consumer(s), %lu items: ", num_producers,
+           num_consumers, total_items);
+
+    lfq::queue<std::unique_ptr<message>> queue;
+    unsigned long per_producer = total_items / num_producers;
+    unsigned long expected = per_producer * num_producers;
+    std::vector<std::atomic<unsigned char>> seen(expected);
+    std::atomic<unsigned long> consumed(0);
+
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < num_producers; p++)
+    {
+        threads.emplace_back([&, p] {
+            for (unsigned long seq = 0; seq < per_producer; seq++)
+            {
+                queue.emplace(new message{p, seq});
+            }
+        });
+    }
+    for (unsigned c = 0; c < num_consumers; c++)
+    {
+        threads.emplace_back([&] {
+            std::vector<long> last(num_producers, -1);
+            while (consumed.load() < expected)
+            {
+                std::unique_ptr<message> msg;
+                if (!queue.try_pop(msg))
+                {
+                    continue;
+                }
+                if (!msg || msg->producer >= num_producers || (long)msg->seq <= last[msg->producer])
+                {
+                    fail("per-producer order broken");
+                }
+                last[msg->producer] = (long)msg->seq;
+                if (seen[msg->producer * per_producer + msg->seq].fetch_add(1) != 0)
+                {
+                    fail("item dequeued twice");
+                }
+                consumed.fetch_add(1);
+            }
+        });
+    }
+    for (std::thread& t : threads)
+    {
+        t.join();
+    }
+
+    std::unique_ptr<message> extra;
+    if (consumed.load() != expected || queue.try_pop(extra))
+    {
+        fail("item count mismatch");
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+/*every constructed string must be destroyed, including the ones left behind in the queue*/
+struct counted
+{
+    static std::atomic<long> live;
+    std::string text;
+
+    explicit counted(std::string t) : text(std::move(t)) { live.fetch_add(1); }
+    counted(counted&& other) noexcept : text(std::move(other.text)) { live.fetch_add(1); }
+    counted& operator=(counted&& other) noexcept
+    {
+        text = std::move(other.text);
+        return *this;
+    }
+    ~counted() { live.fetch_sub(1); }
+};
+std::atomic<long> counted::live(0);
+
+static int lifetime_test(unsigned long total_items)
+{
+    printf("Typed queue item lifetime test, %lu items: ", total_items);
+
+    {
+        lfq::queue<counted> queue;
+        for (unsigned long i = 0; i < total_items; i++)
+        {
+            queue.emplace(std::to_string(i));
+        }
+
+        /*pop half on another thread, leave the rest to the destructor*/
+        std::thread consumer([&] {
+            counted item("");
+            for (unsigned long i = 0; i < total_items / 2; i++)
+            {
+                if (!queue.try_pop(item) || item.text != std::to_string(i))
+                {
+                    fail("FIFO order broken");
+                }
+            }
+        });
+        consumer.join();
+
+        if (counted::live.load() != (long)(total_items - total_items / 2))
+        {
+            fail("a popped item was not destroyed");
+        }
+    }
+
+    if (counted::live.load() != 0)
+    {
+        fail("items left in the queue were not destroyed");
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+/*move assignment throws for negative values*/
+struct fragile
+{
+    static std::atomic<long> live;
+    int value;
+
+    explicit fragile(int v) : value(v) { live.fetch_add(1); }
+    fragile(fragile&& other) noexcept : value(other.value) { live.fetch_add(1); }
+    fragile& operator=(fragile&& other)
+    {
+        if (other.value < 0)
+        {
+            throw std::runtime_error("fragile");
+        }
+        value = other.value;
+        return *this;
+    }
+    ~fragile() { live.fetch_sub(1); }
+};
+std::atomic<long> fragile::live(0);
+
+static int throwing_move_test()
+{
+    printf("Typed queue test with a throwing move assignment: ");
+
+    {
+        lfq::queue<fragile> queue;
+        queue.emplace(-1);
+        queue.emplace(1);
+        fragile out(0);
+
+        /*the throwing item is dropped, the next one is intact*/
+        bool thrown = false;
+        try
+        {
+            queue.try_pop(out);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        if (!thrown || fragile::live.load() != 2)
+        {
+            fail("the item whose move threw was not destroyed");
+        }
+        if (!queue.try_pop(out) || out.value != 1 || queue.try_pop(out))
+        {
+            fail("queue broken after a throwing move");
+        }
+    }
+
+    if (fragile::live.load() != 0)
+    {
+        fail("items leaked");
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+/*trivially copyable payload larger than a word, stored inline*/
+struct point
+{
+    int x;
+    int y;
+    long z;
+};
+
+static int trivial_test(unsigned num_threads, unsigned long total_items)
+{
+    printf("Typed queue test with trivially copyable items, %u thread pair(s), %lu items: ", num_threads, total_items);
+
+    hp_domain_t* domain = hp_domain_create();
+    if (!domain)
+    {
+        fail("hp_domain_create() failed");
+    }
+
+    std::atomic<long> sum(0);
+    {
+        lfq::queue<point> queue(domain);
+        unsigned long per_thread = total_items / num_threads;
+        std::atomic<unsigned long> consumed(0);
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            threads.emplace_back([&] {
+                for (unsigned long n = 0; n < per_thread; n++)
+                {
+                    queue.push(point{1, 2, (long)n});
+                }
+            });
+            threads.emplace_back([&] {
+                point p;
+                while (consumed.load() < per_thread * num_threads)
+                {
+                    if (queue.try_pop(p))
+                    {
+                        if (p.x != 1 || p.y != 2)
+                        {
+                            fail("item corrupted");
+                        }
+                        sum.fetch_add(p.z);
+                        consumed.fetch_add(1);
+                    }
+                }
+            });
+        }
+        for (std::thread& t : threads)
+        {
+            t.join();
+        }
+
+        long expected = (long)num_threads * (long)(per_thread * (per_thread - 1) / 2);
+        if (sum.load() != expected)
+        {
+            fail("sum mismatch");
+        }
+    }
+    /*the queue is gone, its retired nodes are still in the shared domain*/
+    hp_domain_destroy(domain);
+
+    printf("SUCCESS\n");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long total_items = 10000;
+    if (argc >= 2)
+    {
+        total_items = strtoul(argv[1], NULL, 10);
+    }
+
+    move_only_test(10, 10, total_items);
+    lifetime_test(total_items);
+    throwing_move_test();
+    trivial_test(4, total_items);
+
+    return EXIT_SUCCESS;
+}
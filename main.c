@@ -1,9 +1,18 @@
+#define _GNU_SOURCE
+#include <poll.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "LFQueue.h"
+#include "LFShmQueue.h"
 
 typedef struct
 {
@@ -22,6 +31,7 @@ typedef struct
     int total_items;
     bool* enqueue_result;
     bool* dequeue_result;
+    bool blocking_dequeue; /*consumers park in dequeueLF_wait() instead of spinning*/
 } thread_args_t;
 
 void *producer_thread(void *arg)
@@ -46,6 +56,11 @@ void *producer_thread(void *arg)
 
         int serial = atomic_fetch_add(&(args->item_serial_number), 1);
         lfq_err_t ret = enqueueLF(&(args->queue), serial);
+        while (ret == LFQ_EFULL)
+        {
+            /*bounded backend: wait for consumers to make room, the serial is already taken*/
+            ret = enqueueLF(&(args->queue), serial);
+        }
         if (ret == LFQ_OK)
         {
             if (serial >= args->total_items)
@@ -81,7 +96,8 @@ void *consumer_thread(void *arg)
     int serial = 0;
     while (1)
     {
-        lfq_err_t ret = dequeueLF(&(args->queue), &serial);
+        lfq_err_t ret = args->blocking_dequeue ? dequeueLF_wait(&(args->queue), &serial, 10)
+                                               : dequeueLF(&(args->queue), &serial);
         if (ret == LFQ_OK)
         {
             if (serial >= args->total_items)
@@ -112,12 +128,12 @@ int isolated_enqueue_test(unsigned num_producers, unsigned long total_items)
 {
     printf("Isolated enqueue concurrency test with %d producer(s), %lu items to enqueue: ", num_producers, total_items);
 
-    bool enqueue_buf[total_items];
-    bool dequeue_buf[total_items];
-    for (unsigned long i=0; i<total_items; i++)
+    bool *enqueue_buf = calloc(total_items, sizeof(bool));
+    bool *dequeue_buf = calloc(total_items, sizeof(bool));
+    if (!enqueue_buf || !dequeue_buf)
     {
-        enqueue_buf[i] = false;
-        dequeue_buf[i] = false;
+        fprintf(stderr, "Failed to allocate result buffers for %lu items.\n", total_items);
+        exit(EXIT_FAILURE);
     }
     thread_args_t args = {
         .sync = {
@@ -180,6 +196,9 @@ int isolated_enqueue_test(unsigned num_producers, unsigned long total_items)
         }
     }
 
+    free(enqueue_buf);
+    free(dequeue_buf);
+
     printf("SUCCESS\n");
 
     return 0;
@@ -189,12 +208,12 @@ int isolated_dequeue_test(unsigned num_consumers, unsigned long total_items)
 {
     printf("Isolated dequeue concurrency test with %d consumer(s), %lu items to dequeue: ", num_consumers, total_items);
 
-    bool enqueue_buf[total_items];
-    bool dequeue_buf[total_items];
-    for (unsigned long i=0; i<total_items; i++)
+    bool *enqueue_buf = calloc(total_items, sizeof(bool));
+    bool *dequeue_buf = calloc(total_items, sizeof(bool));
+    if (!enqueue_buf || !dequeue_buf)
     {
-        enqueue_buf[i] = false;
-        dequeue_buf[i] = false;
+        fprintf(stderr, "Failed to allocate result buffers for %lu items.\n", total_items);
+        exit(EXIT_FAILURE);
     }
     thread_args_t args = {
         .sync = {
@@ -288,22 +307,33 @@ int isolated_dequeue_test(unsigned num_consumers, unsigned long total_items)
         }
     }
 
+    free(enqueue_buf);
+    free(dequeue_buf);
+
     printf("SUCCESS\n");
 
     return 0;
 }
 
-int integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+int integrated_test_with_attr(unsigned num_producers, unsigned num_consumers, unsigned long total_items,
+                              queue_attr_t *attr, bool blocking_dequeue)
 {
-    printf("Integrated concurrency test with %d producer(s)/%d consumer(s), %lu items to enqueue/dequeue: ",
-           num_producers, num_consumers, total_items);
-
-    bool enqueue_buf[total_items];
-    bool dequeue_buf[total_items];
-    for (unsigned long i=0; i<total_items; i++)
+    printf("Integrated concurrency test with %d producer(s)/%d consumer(s), %lu items to enqueue/dequeue%s%s%s%s: ",
+           num_producers, num_consumers, total_items,
+           (attr && attr->backend == LFQ_BACKEND_RING) ? " (ring backend)" :
+           (attr && attr->backend == LFQ_BACKEND_SEGMENT) ? " (segment backend)" :
+           (attr && attr->reclaim == LFQ_RECLAIM_EBR) ? " (epoch reclamation)" : "",
+           (attr && attr->backoff == LFQ_BACKOFF_EXP) ? " (exponential backoff)" :
+           (attr && attr->backoff == LFQ_BACKOFF_RANDOM) ? " (randomized backoff)" : "",
+           (attr && attr->background_reclaim) ? " (background reclaimer)" : "",
+           blocking_dequeue ? " (blocking dequeue)" : "");
+
+    bool *enqueue_buf = calloc(total_items, sizeof(bool));
+    bool *dequeue_buf = calloc(total_items, sizeof(bool));
+    if (!enqueue_buf || !dequeue_buf)
     {
-        enqueue_buf[i] = false;
-        dequeue_buf[i] = false;
+        fprintf(stderr, "Failed to allocate result buffers for %lu items.\n", total_items);
+        exit(EXIT_FAILURE);
     }
     thread_args_t args = {
         .sync = {
@@ -316,9 +346,10 @@ int integrated_test(unsigned num_producers, unsigned num_consumers, unsigned lon
         .total_items = total_items,
         .enqueue_result = &enqueue_buf[0],
         .dequeue_result = &dequeue_buf[0],
+        .blocking_dequeue = blocking_dequeue,
     };
 
-    LFQueue_init(&args.queue, NULL);
+    LFQueue_init(&args.queue, attr);
 
     pthread_t producer_threads[num_producers];
     for (unsigned i = 0; i < num_producers; i++)
@@ -406,119 +437,1628 @@ int integrated_test(unsigned num_producers, unsigned num_consumers, unsigned lon
         }
     }
 
+    free(enqueue_buf);
+    free(dequeue_buf);
+
     printf("SUCCESS\n");
 
     return 0;
 }
 
-void print_usage(const char* program_name) {
-    printf("Usage: %s [items] [iterations] [test_number]\n", program_name);
-    printf("Test numbers:\n");
-    printf(" 1: Enqueue test with 1 producer\n");
-    printf(" 2: Enqueue test with 10 producers\n");
-    printf(" 3: Dequeue test with 1 consumer\n");
-    printf(" 4: Dequeue test with 10 consumers\n");
-    printf(" 5: Integrated test with 1 producer, 1 consumer\n");
-    printf(" 6: Integrated test with 1 producer, 10 consumers\n");
-    printf(" 7: Integrated test with 10 producers, 1 consumer\n");
-    printf(" 8: Integrated test with 10 producers, 10 consumers\n");
-    printf(" 0: Run all tests (default)\n");
+int integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    return integrated_test_with_attr(num_producers, num_consumers, total_items, NULL, false);
 }
 
+int blocking_integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    return integrated_test_with_attr(num_producers, num_consumers, total_items, NULL, true);
+}
 
-int main(int argc, char **argv)
+int ring_integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
 {
-    unsigned long total_items = 10000;
-    unsigned max = 0;
-    int test_number = -1;
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.backend = LFQ_BACKEND_RING;
+    attr.capacity = 1024;
 
-    if (argc >= 2)
+    return integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+}
+
+int segment_integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.backend = LFQ_BACKEND_SEGMENT;
+
+    return integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+}
+
+int ebr_integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.reclaim = LFQ_RECLAIM_EBR;
+
+    return integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+}
+
+int backoff_integrated_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+
+    attr.backoff = LFQ_BACKOFF_EXP;
+    integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+
+    attr.backoff = LFQ_BACKOFF_RANDOM;
+    return integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+}
+
+#define BULK_BATCH_SIZE (64)
+#define BULK_MAX_PRODUCERS (64)
+
+typedef struct
+{
+    struct LFQueue *queue;
+    unsigned producer_id;
+    unsigned long items_per_producer;
+} bulk_producer_args_t;
+
+void *bulk_producer_thread(void *arg)
+{
+    bulk_producer_args_t *args = (bulk_producer_args_t *)arg;
+    int batch[BULK_BATCH_SIZE];
+
+    unsigned long seq = 0;
+    while (seq < args->items_per_producer)
     {
-        total_items = strtoul(argv[1], NULL, 10);
+        size_t n = 0;
+        while (n < BULK_BATCH_SIZE && seq < args->items_per_producer)
+        {
+            /*producer id in the high bits, per-producer sequence in the low bits*/
+            batch[n++] = (int)((args->producer_id << 24) | seq++);
+        }
+
+        if (enqueueLF_bulk(args->queue, batch, n) != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("enqueueLF_bulk() failed for producer %u\n", args->producer_id);
+            exit(EXIT_FAILURE);
+        }
     }
-    if (argc >= 3)
+
+    LFQueue_cleanup_thread();
+
+    return NULL;
+}
+
+/*for calls that are expected to be rejected*/
+static int quiet_error_callback(const char *format, ...)
+{
+    (void)format;
+    return 0;
+}
+
+int bulk_fifo_test(unsigned num_producers, unsigned long total_items)
+{
+    printf("Bulk FIFO test with %u producer(s)/1 consumer, %lu items to enqueue/dequeue: ", num_producers, total_items);
+
+    if (num_producers == 0 || num_producers > BULK_MAX_PRODUCERS)
     {
-        max = atoi(argv[2]);
+        printf("FAILED\n");
+        printf("producer count must be within 1..%d\n", BULK_MAX_PRODUCERS);
+        exit(EXIT_FAILURE);
     }
-    if (argc >= 4)
+
+    struct LFQueue queue;
+    LFQueue_init(&queue, NULL);
+
+    unsigned long items_per_producer = total_items / num_producers;
+    bulk_producer_args_t args[BULK_MAX_PRODUCERS];
+    pthread_t producer_threads[BULK_MAX_PRODUCERS];
+    for (unsigned i = 0; i < num_producers; i++)
     {
-        test_number = atoi(argv[3]);
+        args[i].queue = &queue;
+        args[i].producer_id = i;
+        args[i].items_per_producer = items_per_producer;
+        if (pthread_create(&producer_threads[i], NULL, bulk_producer_thread, &args[i]) != 0)
+        {
+            fprintf(stderr, "Failed to create producer thread %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    if (test_number < 0 || test_number > 8)
+    unsigned long next_seq[BULK_MAX_PRODUCERS] = {0};
+    unsigned long consumed = 0;
+    unsigned long expected = items_per_producer * num_producers;
+    size_t batch_max = 1;
+    int batch[BULK_BATCH_SIZE];
+    while (consumed < expected)
     {
-        print_usage(argv[0]);
-        return EXIT_FAILURE;
-    }   
+        size_t got = 0;
+        /*vary the batch size so that both partial and full batches are claimed*/
+        batch_max = (batch_max % BULK_BATCH_SIZE) + 1;
+        if (dequeueLF_bulk(&queue, batch, batch_max, &got) != LFQ_OK)
+        {
+            continue;
+        }
 
-    printf("RUNNING TEST: %lu items to enqueue/dequeue, iteration %u times:\n", total_items, max);
+        for (size_t i = 0; i < got; i++)
+        {
+            unsigned producer_id = (unsigned)batch[i] >> 24;
+            unsigned long seq = (unsigned long)batch[i] & 0xFFFFFF;
+            if (producer_id >= num_producers || seq != next_seq[producer_id])
+            {
+                printf("FAILED\n");
+                printf("out of order item from producer %u: expected %lu, got %lu\n",
+                       producer_id, producer_id < num_producers ? next_seq[producer_id] : 0, seq);
+                exit(EXIT_FAILURE);
+            }
+            next_seq[producer_id]++;
+        }
+        consumed += got;
+    }
 
-    switch (test_number)
+    for (unsigned i = 0; i < num_producers; i++)
     {
-        case 0: // All tests
-            for (unsigned i = 0; i < max; i++)
-                isolated_enqueue_test(1, total_items);
+        pthread_join(producer_threads[i], NULL);
+    }
 
-            for (unsigned i = 0; i < max; i++)
-                isolated_enqueue_test(10, total_items);
+    LFQueue_cleanup_thread();
+    LFQueue_destroy(&queue);
+
+    /*a batch larger than a ring can never fit, so it is invalid rather than full*/
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.backend = LFQ_BACKEND_RING;
+    attr.capacity = 4;
+    int oversized[5] = {0};
+    int (*errback)(const char *, ...) = LFQueue_error_callback;
+    LFQueue_set_error_callback(quiet_error_callback);
+    LFQueue_init(&queue, &attr);
+    lfq_err_t ret = enqueueLF_bulk(&queue, oversized, 5);
+    LFQueue_destroy(&queue);
+    LFQueue_set_error_callback(errback);
+    if (ret != LFQ_EINVAL)
+    {
+        printf("FAILED\n");
+        printf("a batch of 5 on a ring of 4 returned %d\n", ret);
+        exit(EXIT_FAILURE);
+    }
 
-            for (unsigned i = 0; i < max; i++)
-                isolated_dequeue_test(1, total_items);
+    printf("SUCCESS\n");
 
-            for (unsigned i = 0; i < max; i++)
-                isolated_dequeue_test(10, total_items);
+    return 0;
+}
 
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(1, 1, total_items);
+typedef struct
+{
+    struct LFQueue *queue;
+    unsigned long total_items;
+    atomic_ulong checksum;
+} domain_worker_args_t;
 
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(1, 10, total_items);
+void *domain_producer_thread(void *arg)
+{
+    domain_worker_args_t *args = (domain_worker_args_t *)arg;
+    for (unsigned long i = 0; i < args->total_items; i++)
+    {
+        while (enqueueLF(args->queue, (int)i) == LFQ_EFULL)
+        {
+        }
+    }
+    LFQueue_cleanup_thread();
+    return NULL;
+}
 
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(10, 1, total_items);
+void *domain_consumer_thread(void *arg)
+{
+    domain_worker_args_t *args = (domain_worker_args_t *)arg;
+    unsigned long sum = 0;
+    for (unsigned long i = 0; i < args->total_items;)
+    {
+        int data = 0;
+        if (dequeueLF_wait(args->queue, &data, 10) == LFQ_OK)
+        {
+            sum += (unsigned long)data;
+            i++;
+        }
+    }
+    atomic_store(&args->checksum, sum);
+    LFQueue_cleanup_thread();
+    return NULL;
+}
 
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(10, 10, total_items);
-            break;
+int domain_isolation_test(unsigned long total_items)
+{
+    printf("Domain isolation test, queues created and destroyed next to a running queue, %lu items: ", total_items);
 
-        case 1:
-            for (unsigned i = 0; i < max; i++)
-                isolated_enqueue_test(1, total_items);
-            break;
+    hp_domain_t *shared = hp_domain_create();
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.domain = shared;
 
-        case 2:
-            for (unsigned i = 0; i < max; i++)
-                isolated_enqueue_test(10, total_items);
-            break;
+    struct LFQueue running;
+    LFQueue_init(&running, &attr);
 
-        case 3:
-            for (unsigned i = 0; i < max; i++)
-                isolated_dequeue_test(1, total_items);
-            break;
+    domain_worker_args_t args = {.queue = &running, .total_items = total_items, .checksum = ATOMIC_VAR_INIT(0)};
+    pthread_t producer, consumer;
+    if (pthread_create(&producer, NULL, domain_producer_thread, &args) != 0 ||
+        pthread_create(&consumer, NULL, domain_consumer_thread, &args) != 0)
+    {
+        fprintf(stderr, "Failed to create worker threads.\n");
+        exit(EXIT_FAILURE);
+    }
 
-        case 4:
-            for (unsigned i = 0; i < max; i++)
-                isolated_dequeue_test(10, total_items);
-            break;
+    /*churn queues in the shared domain and in private domains while the workers run*/
+    for (unsigned round = 0; round < 100; round++)
+    {
+        struct LFQueue shared_queue, private_queue;
+        LFQueue_init(&shared_queue, &attr);
+        LFQueue_init(&private_queue, NULL);
 
-        case 5:
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(1, 1, total_items);
-            break;
+        for (int i = 0; i < 64; i++)
+        {
+            enqueueLF(&shared_queue, i);
+            enqueueLF(&private_queue, i);
+        }
 
-        case 6:
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(1, 10, total_items);
-            break;
+        int data = 0;
+        for (int i = 0; i < 64; i++)
+        {
+            if (dequeueLF(&shared_queue, &data) != LFQ_OK || data != i ||
+                dequeueLF(&private_queue, &data) != LFQ_OK || data != i)
+            {
+                printf("FAILED\n");
+                printf("churn queue returned wrong data in round %u\n", round);
+                exit(EXIT_FAILURE);
+            }
+        }
 
-        case 7:
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(10, 1, total_items);
-            break;
+        LFQueue_destroy(&private_queue);
+        LFQueue_destroy(&shared_queue);
+    }
 
-        case 8:
-            for (unsigned i = 0; i < max; i++)
-                integrated_test(10, 10, total_items);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    unsigned long expected = total_items * (total_items - 1) / 2;
+    if (atomic_load(&args.checksum) != expected)
+    {
+        printf("FAILED\n");
+        printf("Mismatch: Expected checksum (%lu), Actual checksum (%lu)\n", expected, atomic_load(&args.checksum));
+        exit(EXIT_FAILURE);
+    }
+
+    LFQueue_cleanup_thread();
+    LFQueue_destroy(&running);
+    hp_domain_destroy(shared);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+int sojourn_test(unsigned long total_items)
+{
+    printf("Sojourn histogram test on the list and ring backends, %lu items%s: ", total_items,
+           LFQ_SOJOURN ? "" : " (built without LFQ_SOJOURN)");
+
+    lfq_histogram_t merged;
+    memset(&merged, 0, sizeof(merged));
+
+    for (int ring = 0; ring < 2; ring++)
+    {
+        queue_attr_t attr;
+        queue_attr_init(&attr);
+        if (ring)
+        {
+            attr.backend = LFQ_BACKEND_RING;
+            attr.capacity = 1024;
+        }
+
+        struct LFQueue queue;
+        LFQueue_init(&queue, &attr);
+
+        domain_worker_args_t args = {.queue = &queue, .total_items = total_items, .checksum = ATOMIC_VAR_INIT(0)};
+        pthread_t producer, consumer;
+        if (pthread_create(&producer, NULL, domain_producer_thread, &args) != 0 ||
+            pthread_create(&consumer, NULL, domain_consumer_thread, &args) != 0)
+        {
+            fprintf(stderr, "Failed to create worker threads.\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_join(producer, NULL);
+        pthread_join(consumer, NULL);
+
+        lfq_histogram_t hist;
+        LFQueue_get_sojourn(&queue, &hist);
+        size_t expected = LFQ_SOJOURN ? total_items : 0;
+        if (hist.count != expected)
+        {
+            printf("FAILED\n");
+            printf("Mismatch: Expected samples (%zu), Actual samples (%zu) on the %s backend\n", expected, hist.count,
+                   ring ? "ring" : "list");
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned long long p50 = LFQueue_histogram_percentile(&hist, 0.5);
+        unsigned long long p99 = LFQueue_histogram_percentile(&hist, 0.99);
+        if (p50 > p99 || p99 > hist.max_ns || (hist.count && hist.min_ns > p50))
+        {
+            printf("FAILED\n");
+            printf("percentiles out of order: min=%llu p50=%llu p99=%llu max=%llu\n", hist.min_ns, p50, p99,
+                   hist.max_ns);
+            exit(EXIT_FAILURE);
+        }
+
+        LFQueue_histogram_merge(&merged, &hist);
+        LFQueue_destroy(&queue);
+    }
+
+    if (merged.count != (LFQ_SOJOURN ? 2 * total_items : 0))
+    {
+        printf("FAILED\n");
+        printf("merged histogram holds %zu samples\n", merged.count);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+#define SHARDED_MAX_THREADS (64)
+
+typedef struct
+{
+    struct LFShardedQueue *queue;
+    unsigned producer_id;
+    unsigned long items_per_producer;
+    unsigned long total_items;
+    unsigned num_producers;
+    atomic_ulong *consumed;
+    bool *seen;
+} sharded_args_t;
+
+void *sharded_producer_thread(void *arg)
+{
+    sharded_args_t *args = (sharded_args_t *)arg;
+    for (unsigned long seq = 0; seq < args->items_per_producer; seq++)
+    {
+        /*producer id in the high bits, per-producer sequence in the low bits*/
+        if (enqueueLF_sharded(args->queue, (int)((args->producer_id << 24) | seq)) != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("enqueueLF_sharded() failed for producer %u\n", args->producer_id);
+            exit(EXIT_FAILURE);
+        }
+    }
+    LFQueue_cleanup_thread();
+    return NULL;
+}
+
+void *sharded_consumer_thread(void *arg)
+{
+    sharded_args_t *args = (sharded_args_t *)arg;
+    long last_seq[SHARDED_MAX_THREADS];
+    for (unsigned i = 0; i < SHARDED_MAX_THREADS; i++)
+    {
+        last_seq[i] = -1;
+    }
+
+    while (atomic_load(args->consumed) < args->total_items)
+    {
+        int data = 0;
+        if (dequeueLF_sharded(args->queue, &data) != LFQ_OK)
+        {
+            continue;
+        }
+
+        unsigned producer = (unsigned)data >> 24;
+        long seq = data & 0xFFFFFF;
+        /*one producer's items sit in one lane, so every consumer sees them in order*/
+        if (producer >= args->num_producers || seq <= last_seq[producer])
+        {
+            printf("FAILED\n");
+            printf("per-producer order broken: producer %u seq %ld after %ld\n", producer, seq, last_seq[producer]);
+            exit(EXIT_FAILURE);
+        }
+        last_seq[producer] = seq;
+        args->seen[producer * args->items_per_producer + (unsigned long)seq] = true;
+        atomic_fetch_add(args->consumed, 1);
+    }
+    LFQueue_cleanup_thread();
+    return NULL;
+}
+
+int sharded_test(unsigned num_producers, unsigned num_consumers, unsigned lanes, unsigned long total_items)
+{
+    printf("Sharded queue test with %u producer(s)/%u consumer(s) on %u lanes, %lu items to enqueue/dequeue: ",
+           num_producers, num_consumers, lanes, total_items);
+
+    if (num_producers == 0 || num_producers > SHARDED_MAX_THREADS || num_consumers == 0 ||
+        num_consumers > SHARDED_MAX_THREADS)
+    {
+        printf("FAILED\n");
+        printf("thread counts must be within 1..%d\n", SHARDED_MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+
+    struct LFShardedQueue queue;
+    if (LFShardedQueue_init(&queue, lanes, NULL) != 0)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long items_per_producer = total_items / num_producers;
+    unsigned long expected = items_per_producer * num_producers;
+    bool *seen = calloc(expected, sizeof(bool));
+    if (!seen)
+    {
+        fprintf(stderr, "Failed to allocate result buffers for %lu items.\n", expected);
+        exit(EXIT_FAILURE);
+    }
+    atomic_ulong consumed = ATOMIC_VAR_INIT(0);
+
+    sharded_args_t args[SHARDED_MAX_THREADS * 2];
+    pthread_t threads[SHARDED_MAX_THREADS * 2];
+    unsigned num_threads = num_producers + num_consumers;
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        args[i] = (sharded_args_t){.queue = &queue, .producer_id = i, .items_per_producer = items_per_producer,
+                                   .total_items = expected, .num_producers = num_producers,
+                                   .consumed = &consumed, .seen = seen};
+        if (pthread_create(&threads[i], NULL, i < num_producers ? sharded_producer_thread : sharded_consumer_thread,
+                           &args[i]) != 0)
+        {
+            fprintf(stderr, "Failed to create worker threads.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (unsigned long i = 0; i < expected; i++)
+    {
+        if (!seen[i])
+        {
+            printf("FAILED\n");
+            printf("item %lu of producer %lu was never dequeued\n", i % items_per_producer, i / items_per_producer);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    lfq_sharded_stats_t stats;
+    LFShardedQueue_get_stats(&queue, &stats);
+    if (LFQ_STATS && stats.home_dequeues + stats.steals != expected)
+    {
+        printf("FAILED\n");
+        printf("Mismatch: Expected dequeues (%lu), home (%zu) + stolen (%zu)\n", expected, stats.home_dequeues,
+               stats.steals);
+        exit(EXIT_FAILURE);
+    }
+
+    free(seen);
+    LFQueue_cleanup_thread();
+    LFShardedQueue_destroy(&queue);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    struct LFDeque *deque;
+    unsigned long total_items;
+    atomic_ulong *taken;
+    atomic_uchar *hits;
+} deque_args_t;
+
+static void deque_take(deque_args_t *args, int data)
+{
+    if (data < 0 || (unsigned long)data >= args->total_items ||
+        atomic_fetch_add(&args->hits[data], 1) != 0)
+    {
+        printf("FAILED\n");
+        printf("item %d taken twice or never pushed\n", data);
+        exit(EXIT_FAILURE);
+    }
+    atomic_fetch_add(args->taken, 1);
+}
+
+void *deque_owner_thread(void *arg)
+{
+    deque_args_t *args = (deque_args_t *)arg;
+    for (unsigned long i = 0; i < args->total_items; i++)
+    {
+        if (LFDeque_push(args->deque, (int)i) != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("LFDeque_push() failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /*pop now and then, so that the owner races thieves on the last item too*/
+        int data = 0;
+        if (i % 3 == 0 && LFDeque_pop(args->deque, &data) == LFQ_OK)
+        {
+            deque_take(args, data);
+        }
+    }
+
+    int data = 0;
+    while (LFDeque_pop(args->deque, &data) == LFQ_OK)
+    {
+        deque_take(args, data);
+    }
+    LFQueue_cleanup_thread();
+    return NULL;
+}
+
+void *deque_thief_thread(void *arg)
+{
+    deque_args_t *args = (deque_args_t *)arg;
+    while (atomic_load(args->taken) < args->total_items)
+    {
+        int data = 0;
+        if (LFDeque_steal(args->deque, &data) == LFQ_OK)
+        {
+            deque_take(args, data);
+        }
+    }
+    LFQueue_cleanup_thread();
+    return NULL;
+}
+
+int deque_test(unsigned num_thieves, unsigned long total_items)
+{
+    printf("Work-stealing deque test with 1 owner/%u thie%s, %lu items to push: ", num_thieves,
+           num_thieves == 1 ? "f" : "ves", total_items);
+
+    /*start tiny so that the buffer grows, and retires old buffers, while thieves read them*/
+    struct LFDeque deque;
+    if (LFDeque_init(&deque, 2, NULL) != 0)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_uchar *hits = calloc(total_items ? total_items : 1, sizeof(atomic_uchar));
+    pthread_t *threads = calloc(num_thieves + 1, sizeof(pthread_t));
+    if (!hits || !threads)
+    {
+        fprintf(stderr, "Failed to allocate result buffers for %lu items.\n", total_items);
+        exit(EXIT_FAILURE);
+    }
+    atomic_ulong taken = ATOMIC_VAR_INIT(0);
+    deque_args_t args = {.deque = &deque, .total_items = total_items, .taken = &taken, .hits = hits};
+
+    for (unsigned i = 0; i <= num_thieves; i++)
+    {
+        if (pthread_create(&threads[i], NULL, i == 0 ? deque_owner_thread : deque_thief_thread, &args) != 0)
+        {
+            fprintf(stderr, "Failed to create worker threads.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (unsigned i = 0; i <= num_thieves; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (atomic_load(&taken) != total_items || LFDeque_size_approx(&deque) != 0)
+    {
+        printf("FAILED\n");
+        printf("Mismatch: pushed (%lu), taken (%lu)\n", total_items, atomic_load(&taken));
+        exit(EXIT_FAILURE);
+    }
+
+    free(threads);
+    free(hits);
+    LFDeque_destroy(&deque);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    struct LFQueue *queue;
+    unsigned long items;
+} churn_args_t;
+
+/*deliberately never calls LFQueue_cleanup_thread()*/
+void *churn_thread(void *arg)
+{
+    churn_args_t *args = (churn_args_t *)arg;
+    for (unsigned long i = 0; i < args->items; i++)
+    {
+        int data = 0;
+        if (enqueueLF(args->queue, (int)i) != LFQ_OK || dequeueLF(args->queue, &data) != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("enqueueLF()/dequeueLF() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return NULL;
+}
+
+int thread_churn_test(unsigned batch, unsigned rounds, unsigned long total_items)
+{
+    printf("Thread churn test, %u rounds of %u threads exiting without cleanup, %lu items: ", rounds, batch,
+           total_items);
+
+    struct LFQueue queue;
+    if (LFQueue_init(&queue, NULL) != 0)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t *threads = calloc(batch, sizeof(pthread_t));
+    if (!threads)
+    {
+        fprintf(stderr, "Failed to allocate %u thread handles.\n", batch);
+        exit(EXIT_FAILURE);
+    }
+    churn_args_t args = {.queue = &queue, .items = total_items / ((unsigned long)batch * rounds) + 1};
+
+    for (unsigned r = 0; r < rounds; r++)
+    {
+        for (unsigned i = 0; i < batch; i++)
+        {
+            if (pthread_create(&threads[i], NULL, churn_thread, &args) != 0)
+            {
+                fprintf(stderr, "Failed to create worker threads.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (unsigned i = 0; i < batch; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    /*records of exited threads were released and reused, so only one batch worth was ever needed*/
+    lfq_stats_t stats;
+    LFQueue_get_stats(&queue, &stats);
+    if (LFQ_STATS && (stats.active_records != 0 || stats.records > batch))
+    {
+        printf("FAILED\n");
+        printf("%zu records (%zu active) after %u exited threads\n", stats.records, stats.active_records,
+               batch * rounds);
+        exit(EXIT_FAILURE);
+    }
+
+    free(threads);
+    LFQueue_destroy(&queue);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+int background_reclaim_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    hp_domain_t *domain = hp_domain_create();
+    if (!domain)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.domain = domain;
+    attr.background_reclaim = true;
+    integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+    attr.backend = LFQ_BACKEND_SEGMENT;
+    integrated_test_with_attr(num_producers, num_consumers, total_items, &attr, false);
+
+    printf("Background reclaimer hand-off test: ");
+    lfq_reclaimer_stats_t stats;
+    hp_domain_get_reclaimer_stats(domain, &stats);
+    if (stats.items_handed_off == 0 || stats.handoffs == 0 || stats.inline_scans != 0)
+    {
+        printf("FAILED\n");
+        printf("%zu hand-offs of %zu items, %zu inline scans\n", stats.handoffs, stats.items_handed_off,
+               stats.inline_scans);
+        exit(EXIT_FAILURE);
+    }
+
+    /*stops the reclaimer, which frees what it still holds*/
+    hp_domain_destroy(domain);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    struct LFQueue *queue;
+    unsigned long items;
+    atomic_ulong *consumed;
+    unsigned long total_items;
+    atomic_bool *overflow;
+} bounded_args_t;
+
+/*retries on LFQ_EFULL until its share is in*/
+void *bounded_producer_thread(void *arg)
+{
+    bounded_args_t *args = (bounded_args_t *)arg;
+    for (unsigned long i = 0; i < args->items; i++)
+    {
+        lfq_err_t ret;
+        while ((ret = enqueueLF(args->queue, (int)i)) == LFQ_EFULL)
+        {
+            sched_yield();
+        }
+        if (ret != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("enqueueLF() returned %d\n", ret);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return NULL;
+}
+
+void *bounded_consumer_thread(void *arg)
+{
+    bounded_args_t *args = (bounded_args_t *)arg;
+    while (atomic_load(args->consumed) < args->total_items)
+    {
+        if (LFQueue_size_approx(args->queue) > args->queue->attr.max_size)
+        {
+            atomic_store(args->overflow, true);
+        }
+
+        int data = 0;
+        if (dequeueLF(args->queue, &data) == LFQ_OK)
+        {
+            atomic_fetch_add(args->consumed, 1);
+        }
+    }
+    return NULL;
+}
+
+int size_test(unsigned num_producers, unsigned num_consumers, size_t max_size, unsigned long total_items)
+{
+    printf("Size and capacity test with %u producer(s)/%u consumer(s), capacity %zu, %lu items: ", num_producers,
+           num_consumers, max_size, total_items);
+
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.max_size = max_size;
+    struct LFQueue queue;
+    if (LFQueue_init(&queue, &attr) != 0)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /*single-threaded: exactly max_size items fit, and the size follows every operation*/
+    for (size_t i = 0; i < max_size; i++)
+    {
+        if (enqueueLF(&queue, (int)i) != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("enqueueLF() refused item %zu of %zu\n", i, max_size);
+            exit(EXIT_FAILURE);
+        }
+    }
+    int data = 0;
+    int batch[5] = {0};
+    size_t got = 0;
+    if (enqueueLF(&queue, -1) != LFQ_EFULL || enqueueLF_bulk(&queue, batch, 1) != LFQ_EFULL ||
+        LFQueue_size_approx(&queue) != max_size || dequeueLF(&queue, &data) != LFQ_OK ||
+        dequeueLF_bulk(&queue, batch, 4, &got) != LFQ_OK || LFQueue_size_approx(&queue) != max_size - 1 - got ||
+        enqueueLF_bulk(&queue, batch, got + 1) != LFQ_OK || enqueueLF(&queue, -1) != LFQ_EFULL)
+    {
+        printf("FAILED\n");
+        printf("capacity or size off: size %zu of %zu\n", LFQueue_size_approx(&queue), max_size);
+        exit(EXIT_FAILURE);
+    }
+    while (dequeueLF(&queue, &data) == LFQ_OK)
+    {
+    }
+
+    /*a batch beyond the bound can never fit, so it is invalid rather than full*/
+    int *oversized = calloc(max_size + 1, sizeof(int));
+    int (*errback)(const char *, ...) = LFQueue_error_callback;
+    LFQueue_set_error_callback(quiet_error_callback);
+    lfq_err_t ret = oversized ? enqueueLF_bulk(&queue, oversized, max_size + 1) : LFQ_ENOMEM;
+    LFQueue_set_error_callback(errback);
+    free(oversized);
+    if (ret != LFQ_EINVAL || LFQueue_size_approx(&queue) != 0)
+    {
+        printf("FAILED\n");
+        printf("a batch of %zu on a bound of %zu returned %d\n", max_size + 1, max_size, ret);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long per_producer = total_items / num_producers;
+    atomic_ulong consumed = ATOMIC_VAR_INIT(0);
+    atomic_bool overflow = ATOMIC_VAR_INIT(false);
+    bounded_args_t args = {.queue = &queue, .items = per_producer, .consumed = &consumed,
+                           .total_items = per_producer * num_producers, .overflow = &overflow};
+    pthread_t threads[num_producers + num_consumers];
+    for (unsigned i = 0; i < num_producers + num_consumers; i++)
+    {
+        if (pthread_create(&threads[i], NULL, i < num_producers ? bounded_producer_thread : bounded_consumer_thread,
+                           &args) != 0)
+        {
+            fprintf(stderr, "Failed to create worker threads.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (unsigned i = 0; i < num_producers + num_consumers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (atomic_load(&overflow) || LFQueue_size_approx(&queue) != 0)
+    {
+        printf("FAILED\n");
+        printf("size went past the capacity, or is %zu after draining\n", LFQueue_size_approx(&queue));
+        exit(EXIT_FAILURE);
+    }
+
+    LFQueue_destroy(&queue);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    struct LFQueue *queue;
+    unsigned long items;
+} eventfd_args_t;
+
+/*bursts with pauses, so that the queue runs empty and the fd has edges to report*/
+void *eventfd_producer_thread(void *arg)
+{
+    eventfd_args_t *args = (eventfd_args_t *)arg;
+    for (unsigned long i = 0; i < args->items; i++)
+    {
+        if (enqueueLF(args->queue, (int)i) != LFQ_OK)
+        {
+            printf("FAILED\n");
+            printf("enqueueLF() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        if (i % 256 == 255)
+        {
+            nanosleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+        }
+    }
+    return NULL;
+}
+
+static bool fd_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) == 1 && (pfd.revents & POLLIN);
+}
+
+int eventfd_test(unsigned num_producers, unsigned long total_items)
+{
+    printf("Eventfd readiness test with %u producer(s)/1 polling consumer, %lu items: ", num_producers, total_items);
+
+    queue_attr_t attr;
+    queue_attr_init(&attr);
+    attr.eventfd = true;
+    struct LFQueue queue;
+    if (LFQueue_init(&queue, &attr) != 0 || LFQueue_fd(&queue) < 0)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    int fd = LFQueue_fd(&queue);
+
+    /*one write for a whole burst, one read by the dequeue that finds the queue empty again*/
+    int data = 0;
+    bool idle = !fd_readable(fd, 0);
+    for (int i = 0; i < 100; i++)
+    {
+        enqueueLF(&queue, i);
+    }
+    bool ready = fd_readable(fd, 0);
+    while (dequeueLF(&queue, &data) == LFQ_OK)
+    {
+    }
+    lfq_stats_t stats;
+    LFQueue_get_stats(&queue, &stats);
+    if (!idle || !ready || fd_readable(fd, 0) || stats.fd_writes != 1 || stats.fd_reads != 1)
+    {
+        printf("FAILED\n");
+        printf("fd readable before/with/after items: %d/%d/%d, %zu writes, %zu reads\n", !idle, ready,
+               fd_readable(fd, 0), stats.fd_writes, stats.fd_reads);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long per_producer = total_items / num_producers;
+    unsigned long expected = per_producer * num_producers;
+    eventfd_args_t args = {.queue = &queue, .items = per_producer};
+    pthread_t threads[num_producers];
+    for (unsigned i = 0; i < num_producers; i++)
+    {
+        if (pthread_create(&threads[i], NULL, eventfd_producer_thread, &args) != 0)
+        {
+            fprintf(stderr, "Failed to create worker threads.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /*the consumer only ever sleeps in poll(); a lost edge would stall it until the timeout*/
+    unsigned long consumed = 0;
+    while (consumed < expected)
+    {
+        if (!fd_readable(fd, 5000))
+        {
+            printf("FAILED\n");
+            printf("no readiness with %lu of %lu items consumed\n", consumed, expected);
+            exit(EXIT_FAILURE);
+        }
+        while (dequeueLF(&queue, &data) == LFQ_OK)
+        {
+            consumed++;
+        }
+    }
+    for (unsigned i = 0; i < num_producers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    LFQueue_get_stats(&queue, &stats);
+    if (stats.fd_writes > expected / 2 || fd_readable(fd, 0))
+    {
+        printf("FAILED\n");
+        printf("%zu eventfd writes for %lu items\n", stats.fd_writes, expected);
+        exit(EXIT_FAILURE);
+    }
+
+    LFQueue_cleanup_thread();
+    LFQueue_destroy(&queue);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    atomic_ulong consumed;
+    atomic_int failed;
+    atomic_uchar seen[];
+} shm_shared_t;
+
+/*Child process: attach by name, move its share of the items, detach*/
+static void shm_child(const char* name, shm_shared_t* shared, bool producer, unsigned index, unsigned long per_producer,
+                      unsigned long expected)
+{
+    struct LFShmQueue queue;
+    if (LFShmQueue_attach(&queue, name) != 0)
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    if (producer)
+    {
+        for (unsigned long i = 0; i < per_producer; i++)
+        {
+            while (enqueueLF_shm(&queue, (int)(index * per_producer + i)) == LFQ_EFULL)
+            {
+                sched_yield();
+            }
+        }
+    }
+    else
+    {
+        int data;
+        while (atomic_load(&shared->consumed) < expected)
+        {
+            if (dequeueLF_shm(&queue, &data) != LFQ_OK)
+            {
+                sched_yield();
+                continue;
+            }
+            if (data < 0 || (unsigned long)data >= expected || atomic_exchange(&shared->seen[data], 1))
+            {
+                atomic_store(&shared->failed, 1);
+            }
+            atomic_fetch_add(&shared->consumed, 1);
+        }
+    }
+
+    LFShmQueue_detach(&queue);
+    _exit(EXIT_SUCCESS);
+}
+
+int shm_test(unsigned num_producers, unsigned num_consumers, unsigned long total_items)
+{
+    printf("Process-shared queue test with %u producer/%u consumer processes, %lu items: ", num_producers,
+           num_consumers, total_items);
+
+    const size_t capacity = 1000;
+    char name[64];
+    snprintf(name, sizeof(name), "/lfq_test_%d", (int)getpid());
+
+    struct LFShmQueue queue;
+    if (LFShmQueue_create(&queue, name, LFShmQueue_arena_size(capacity, 16), 16) != 0 ||
+        LFShmQueue_capacity(&queue) != capacity)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long per_producer = total_items / num_producers;
+    unsigned long expected = per_producer * num_producers;
+    size_t shared_size = sizeof(shm_shared_t) + expected;
+    shm_shared_t* shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout); /*so the children do not print the buffered output again*/
+    pid_t *children = calloc(num_producers + num_consumers, sizeof(pid_t));
+    if (!children)
+    {
+        printf("FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned i = 0; i < num_producers + num_consumers; i++)
+    {
+        children[i] = fork();
+        if (children[i] < 0)
+        {
+            fprintf(stderr, "Failed to create worker processes.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (children[i] == 0)
+        {
+            shm_child(name, shared, i < num_producers, i, per_producer, expected);
+        }
+    }
+
+    bool ok = true;
+    for (unsigned i = 0; i < num_producers + num_consumers; i++)
+    {
+        int status;
+        ok &= waitpid(children[i], &status, 0) == children[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    free(children);
+    for (unsigned long i = 0; i < expected; i++)
+    {
+        ok &= atomic_load(&shared->seen[i]) == 1;
+    }
+    if (!ok || atomic_load(&shared->failed) || atomic_load(&shared->consumed) != expected)
+    {
+        printf("FAILED\n");
+        printf("%lu of %lu items consumed, lost or duplicated ones: %d\n", atomic_load(&shared->consumed), expected,
+               atomic_load(&shared->failed));
+        exit(EXIT_FAILURE);
+    }
+    munmap(shared, shared_size);
+
+    /*a process killed with a record and retired nodes of its own must not cost the others any capacity*/
+    for (int i = 0; i < 100; i++)
+    {
+        enqueueLF_shm(&queue, i);
+    }
+    pid_t victim = fork();
+    if (victim == 0)
+    {
+        struct LFShmQueue crashing;
+        int data;
+        if (LFShmQueue_attach(&crashing, name) != 0)
+        {
+            _exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < 50; i++)
+        {
+            if (dequeueLF_shm(&crashing, &data) != LFQ_OK || data != i)
+            {
+                _exit(EXIT_FAILURE);
+            }
+        }
+        kill(getpid(), SIGKILL);
+    }
+    int status;
+    unsigned recovered = 0;
+    if (victim > 0 && waitpid(victim, &status, 0) == victim && WIFSIGNALED(status))
+    {
+        recovered = LFShmQueue_recover(&queue);
+    }
+
+    int data;
+    for (int i = 50; i < 100; i++)
+    {
+        ok &= dequeueLF_shm(&queue, &data) == LFQ_OK && data == i;
+    }
+    ok &= dequeueLF_shm(&queue, &data) == LFQ_EEMPTY;
+
+    size_t filled = 0;
+    while (enqueueLF_shm(&queue, (int)filled) == LFQ_OK)
+    {
+        filled++;
+    }
+    size_t drained = 0;
+    while (dequeueLF_shm(&queue, &data) == LFQ_OK && data == (int)drained)
+    {
+        drained++;
+    }
+    if (!ok || recovered < 1 || filled != capacity || drained != capacity)
+    {
+        printf("FAILED\n");
+        printf("%u records recovered, %zu of %zu items fit after the crash, %zu drained in order\n", recovered,
+               filled, capacity, drained);
+        exit(EXIT_FAILURE);
+    }
+
+    LFShmQueue_detach(&queue);
+    LFShmQueue_unlink(name);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+int stats_test(unsigned long total_items)
+{
+    printf("Statistics test, 1 producer/1 consumer then a quiescent phase, %lu items%s: ", total_items,
+           LFQ_STATS ? "" : " (built without LFQ_STATS)");
+
+    struct LFQueue queue;
+    LFQueue_init(&queue, NULL);
+
+    domain_worker_args_t args = {.queue = &queue, .total_items = total_items, .checksum = ATOMIC_VAR_INIT(0)};
+    pthread_t producer, consumer;
+    if (pthread_create(&producer, NULL, domain_producer_thread, &args) != 0 ||
+        pthread_create(&consumer, NULL, domain_consumer_thread, &args) != 0)
+    {
+        fprintf(stderr, "Failed to create worker threads.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    /*one thread, nothing else running: no CAS can fail, and a Scan() keeps at most the node its own dequeue still protects*/
+    lfq_stats_t before, after;
+    LFQueue_get_stats(&queue, &before);
+    int data = 0;
+    for (unsigned long i = 0; i < total_items; i++)
+    {
+        enqueueLF(&queue, (int)i);
+        dequeueLF(&queue, &data);
+    }
+    LFQueue_get_stats(&queue, &after);
+
+    /*below a few retire thresholds there need not be any Scan()*/
+    bool scanned = LFQ_STATS && total_items >= 64;
+    bool busy_ok = !scanned || (before.scans > 0 && before.nodes_freed > 0 && before.nodes_freed <= total_items);
+    bool quiet_ok = after.enqueue_cas_failures == before.enqueue_cas_failures &&
+                    after.dequeue_cas_failures == before.dequeue_cas_failures &&
+                    after.protect_retries == before.protect_retries && after.tail_helps == before.tail_helps &&
+                    after.nodes_kept - before.nodes_kept <= after.scans - before.scans &&
+                    (!scanned || (after.scans > before.scans && after.nodes_freed >= before.nodes_freed + total_items / 2));
+    if (!busy_ok || !quiet_ok)
+    {
+        printf("FAILED\n");
+        printf("busy: %zu scans, %zu freed; quiescent: +%zu scans, +%zu freed, +%zu kept, +%zu/+%zu CAS failures, "
+               "+%zu protect retries, +%zu tail helps\n",
+               before.scans, before.nodes_freed, after.scans - before.scans, after.nodes_freed - before.nodes_freed,
+               after.nodes_kept - before.nodes_kept, after.enqueue_cas_failures - before.enqueue_cas_failures,
+               after.dequeue_cas_failures - before.dequeue_cas_failures,
+               after.protect_retries - before.protect_retries, after.tail_helps - before.tail_helps);
+        exit(EXIT_FAILURE);
+    }
+
+    LFQueue_cleanup_thread();
+    LFQueue_destroy(&queue);
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    pthread_barrier_t barrier;
+    unsigned long total_items;
+    bool ok;
+} pool_bystander_args_t;
+
+static bool pool_round_trip(unsigned long total_items)
+{
+    struct LFQueue queue;
+    if (LFQueue_init(&queue, NULL) != 0)
+    {
+        return false;
+    }
+    bool ok = true;
+    int data = 0;
+    for (unsigned long i = 0; i < total_items && ok; i++)
+    {
+        ok = enqueueLF(&queue, (int)i) == LFQ_OK && dequeueLF(&queue, &data) == LFQ_OK && data == (int)i;
+    }
+    LFQueue_destroy(&queue);
+    return ok;
+}
+
+/*fills its node cache, sits out LFQueue_pool_release() without exiting, then uses the pool again*/
+static void *pool_bystander_thread(void *arg)
+{
+    pool_bystander_args_t *args = arg;
+    bool ok = pool_round_trip(args->total_items);
+    pthread_barrier_wait(&args->barrier);
+    pthread_barrier_wait(&args->barrier);
+    args->ok = ok && pool_round_trip(args->total_items);
+    LFQueue_cleanup_thread();
+    return NULL;
+}
+
+int pool_test(unsigned long total_items)
+{
+    printf("Node pool test, cache of 8 nodes, %lu items, then release under a live thread%s: ", total_items,
+           LFQ_NODE_POOL ? "" : " (built without LFQ_NODE_POOL)");
+
+    int (*errback)(const char *, ...) = LFQueue_error_callback;
+    LFQueue_set_error_callback(quiet_error_callback);
+    int zero_ret = LFQueue_pool_set_cache_size(0);
+    int null_ret = LFQueue_pool_get_stats(NULL);
+    LFQueue_set_error_callback(errback);
+
+    LFQueue_pool_set_cache_size(8);
+    lfq_pool_stats_t before, after, released, refilled;
+    LFQueue_pool_get_stats(&before);
+
+    struct LFQueue queue;
+    LFQueue_init(&queue, NULL);
+    int data = 0;
+    for (unsigned long i = 0; i < total_items; i++)
+    {
+        enqueueLF(&queue, (int)i);
+        dequeueLF(&queue, &data);
+    }
+    LFQueue_cleanup_thread();
+    LFQueue_destroy(&queue);
+    LFQueue_pool_get_stats(&after);
+
+    /*every other test has joined its threads and destroyed its queues, so nothing points into a slab any more*/
+    pool_bystander_args_t args = {.total_items = total_items, .ok = false};
+    pthread_barrier_init(&args.barrier, NULL, 2);
+    pthread_t bystander;
+    if (pthread_create(&bystander, NULL, pool_bystander_thread, &args) != 0)
+    {
+        fprintf(stderr, "Failed to create the bystander thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_wait(&args.barrier);
+    LFQueue_pool_release();
+    LFQueue_pool_get_stats(&released);
+    pthread_barrier_wait(&args.barrier);
+    pthread_join(bystander, NULL);
+    pthread_barrier_destroy(&args.barrier);
+
+    LFQueue_init(&queue, NULL);
+    enqueueLF(&queue, 1);
+    bool reused = dequeueLF(&queue, &data) == LFQ_OK && data == 1;
+    LFQueue_cleanup_thread();
+    LFQueue_destroy(&queue);
+    LFQueue_pool_get_stats(&refilled);
+    LFQueue_pool_set_cache_size(LFQ_POOL_DEFAULT_CACHE_SIZE);
+
+    /*each node_alloc() is a hit or a miss; with 8 cached nodes the cache runs dry well before a slab is used up*/
+    bool pooled = !LFQ_NODE_POOL ||
+                  ((after.hits + after.misses) - (before.hits + before.misses) >= total_items &&
+                   (total_items <= LFQ_POOL_SLAB_NODES || after.misses > before.misses) && after.slabs >= 1 &&
+                   released.slabs == 0 && released.hits == 0 && released.misses == 0 && refilled.slabs >= 1);
+    if (zero_ret != -1 || null_ret != -1 || !reused || !args.ok || !pooled)
+    {
+        printf("FAILED\n");
+        printf("set_cache_size(0) %d, get_stats(NULL) %d; +%zu hits, +%zu misses, %zu slabs; after release "
+               "%zu slabs, %zu hits, %zu misses; %zu after refill; bystander %s\n",
+               zero_ret, null_ret, after.hits - before.hits, after.misses - before.misses, after.slabs,
+               released.slabs, released.hits, released.misses, refilled.slabs, args.ok ? "ok" : "failed");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("SUCCESS\n");
+
+    return 0;
+}
+
+/*Scan() latency used to be printed here; bench reports it, built without sanitizers and with LFQ_SCAN_TIMING*/
+void thread_sweep_test(unsigned long total_items)
+{
+    for (unsigned threads = 1; threads <= 64; threads <<= 1)
+    {
+        integrated_test(threads, threads, total_items);
+    }
+}
+
+void print_usage(const char* program_name) {
+    printf("Usage: %s [items] [iterations] [test_number]\n", program_name);
+    printf("Test numbers:\n");
+    printf(" 1: Enqueue test with 1 producer\n");
+    printf(" 2: Enqueue test with 10 producers\n");
+    printf(" 3: Dequeue test with 1 consumer\n");
+    printf(" 4: Dequeue test with 10 consumers\n");
+    printf(" 5: Integrated test with 1 producer, 1 consumer\n");
+    printf(" 6: Integrated test with 1 producer, 10 consumers\n");
+    printf(" 7: Integrated test with 10 producers, 1 consumer\n");
+    printf(" 8: Integrated test with 10 producers, 10 consumers\n");
+    printf(" 9: Integrated test sweep, 1..64 producers/consumers (Scan() latency: see ./bench)\n");
+    printf("10: Bulk FIFO test with 10 producers, 1 consumer\n");
+    printf("11: Integrated test on the ring backend with 10 producers, 10 consumers\n");
+    printf("12: Integrated test with blocking dequeue, 10 producers, 10 consumers\n");
+    printf("13: Hazard pointer domain isolation test\n");
+    printf("14: Integrated test with epoch-based reclamation, 10 producers, 10 consumers\n");
+    printf("15: Sojourn histogram test (counts only with -DLFQ_SOJOURN=1)\n");
+    printf("16: Integrated test with exponential and randomized CAS backoff, 10 producers, 10 consumers\n");
+    printf("17: Integrated test on the segment backend with 10 producers, 10 consumers\n");
+    printf("18: Sharded queue test with 10 producers, 10 consumers, 4 lanes\n");
+    printf("19: Work-stealing deque test with 1 owner, 10 thieves\n");
+    printf("20: Thread churn test, 50 rounds of 8 threads that exit without cleanup\n");
+    printf("21: Background reclaimer test with 10 producers, 10 consumers\n");
+    printf("22: Size and capacity test with 10 producers, 10 consumers, capacity 100\n");
+    printf("23: Eventfd readiness test with 4 producers, 1 polling consumer\n");
+    printf("24: Process-shared queue test with 2 producer, 2 consumer processes\n");
+    printf("25: Statistics test, counters after a quiescent single-threaded phase\n");
+    printf("26: Node pool test, small per-thread cache, stats and release\n");
+    printf(" 0: Run all tests (default)\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned long total_items = 10000;
+    unsigned max = 0;
+    int test_number = -1;
+
+    if (argc >= 2)
+    {
+        total_items = strtoul(argv[1], NULL, 10);
+    }
+    if (argc >= 3)
+    {
+        max = atoi(argv[2]);
+    }
+    if (argc >= 4)
+    {
+        test_number = atoi(argv[3]);
+    }
+
+    if (test_number < 0 || test_number > 26)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }   
+
+    printf("RUNNING TEST: %lu items to enqueue/dequeue, iteration %u times:\n", total_items, max);
+
+    switch (test_number)
+    {
+        case 0: // All tests
+            for (unsigned i = 0; i < max; i++)
+                isolated_enqueue_test(1, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                isolated_enqueue_test(10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                isolated_dequeue_test(1, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                isolated_dequeue_test(10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(1, 1, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(1, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(10, 1, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                bulk_fifo_test(10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                ring_integrated_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                blocking_integrated_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                domain_isolation_test(total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                ebr_integrated_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                sojourn_test(total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                backoff_integrated_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                segment_integrated_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                sharded_test(10, 10, 4, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                deque_test(10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                thread_churn_test(8, 50, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                background_reclaim_test(10, 10, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                size_test(10, 10, 100, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                eventfd_test(4, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                shm_test(2, 2, total_items);
+
+            for (unsigned i = 0; i < max; i++)
+                stats_test(total_items);
+
+            /*last: it frees every slab*/
+            for (unsigned i = 0; i < max; i++)
+                pool_test(total_items);
+            break;
+
+        case 1:
+            for (unsigned i = 0; i < max; i++)
+                isolated_enqueue_test(1, total_items);
+            break;
+
+        case 2:
+            for (unsigned i = 0; i < max; i++)
+                isolated_enqueue_test(10, total_items);
+            break;
+
+        case 3:
+            for (unsigned i = 0; i < max; i++)
+                isolated_dequeue_test(1, total_items);
+            break;
+
+        case 4:
+            for (unsigned i = 0; i < max; i++)
+                isolated_dequeue_test(10, total_items);
+            break;
+
+        case 5:
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(1, 1, total_items);
+            break;
+
+        case 6:
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(1, 10, total_items);
+            break;
+
+        case 7:
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(10, 1, total_items);
+            break;
+
+        case 8:
+            for (unsigned i = 0; i < max; i++)
+                integrated_test(10, 10, total_items);
+            break;
+
+        case 9:
+            for (unsigned i = 0; i < max; i++)
+                thread_sweep_test(total_items);
+            break;
+
+        case 10:
+            for (unsigned i = 0; i < max; i++)
+                bulk_fifo_test(10, total_items);
+            break;
+
+        case 11:
+            for (unsigned i = 0; i < max; i++)
+                ring_integrated_test(10, 10, total_items);
+            break;
+
+        case 12:
+            for (unsigned i = 0; i < max; i++)
+                blocking_integrated_test(10, 10, total_items);
+            break;
+
+        case 13:
+            for (unsigned i = 0; i < max; i++)
+                domain_isolation_test(total_items);
+            break;
+
+        case 14:
+            for (unsigned i = 0; i < max; i++)
+                ebr_integrated_test(10, 10, total_items);
+            break;
+
+        case 15:
+            for (unsigned i = 0; i < max; i++)
+                sojourn_test(total_items);
+            break;
+
+        case 16:
+            for (unsigned i = 0; i < max; i++)
+                backoff_integrated_test(10, 10, total_items);
+            break;
+
+        case 17:
+            for (unsigned i = 0; i < max; i++)
+                segment_integrated_test(10, 10, total_items);
+            break;
+
+        case 18:
+            for (unsigned i = 0; i < max; i++)
+                sharded_test(10, 10, 4, total_items);
+            break;
+
+        case 19:
+            for (unsigned i = 0; i < max; i++)
+                deque_test(10, total_items);
+            break;
+
+        case 20:
+            for (unsigned i = 0; i < max; i++)
+                thread_churn_test(8, 50, total_items);
+            break;
+
+        case 21:
+            for (unsigned i = 0; i < max; i++)
+                background_reclaim_test(10, 10, total_items);
+            break;
+
+        case 22:
+            for (unsigned i = 0; i < max; i++)
+                size_test(10, 10, 100, total_items);
+            break;
+
+        case 23:
+            for (unsigned i = 0; i < max; i++)
+                eventfd_test(4, total_items);
+            break;
+
+        case 24:
+            for (unsigned i = 0; i < max; i++)
+                shm_test(2, 2, total_items);
+            break;
+
+        case 25:
+            for (unsigned i = 0; i < max; i++)
+                stats_test(total_items);
+            break;
+
+        case 26:
+            for (unsigned i = 0; i < max; i++)
+                pool_test(total_items);
             break;
     }
 